@@ -0,0 +1,72 @@
+#include "accounting.h"
+
+static double wallNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+void accountStart(JobAccount* account, const char* name) {
+    account->name = name;
+    for (int s = 0; s < ACCOUNT_NUM_STAGES; s++)
+        atomic_init(&account->cpuNs[s], 0);
+    atomic_init(&account->frames, 0);
+    atomic_init(&account->bytes, 0);
+    getrusage(RUSAGE_SELF, &account->startUsage);
+    account->startWall = wallNow();
+}
+
+int accountWrite(void* context, const uint8_t* data, const size_t numBytes) {
+    AccountWriter* writer = (AccountWriter*) context;
+    long long start = writer->stage >= 0 ? accountThreadNs() : 0;
+    int result = writer->fn(writer->context, data, numBytes);
+    if (writer->stage >= 0)
+        accountAdd(writer->account, (AccountStage) writer->stage, start);
+    if (writer->countBytes && result == 0)
+        atomic_fetch_add_explicit(&writer->account->bytes, numBytes,
+            memory_order_relaxed);
+    return result;
+}
+
+// Write s as a JSON string.
+static void writeJsonString(const char* s, FILE* out) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char) *s >= 0x20)
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void accountWriteRecord(const JobAccount* account, FILE* out) {
+    static const char* stageNames[ACCOUNT_NUM_STAGES] = {
+        "trace", "diff", "encode", "write"
+    };
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double wall = wallNow() - account->startWall;
+    
+    fputs("{\"job\":", out);
+    writeJsonString(account->name, out);
+    fprintf(out, ",\"frames\":%lld,\"bytes\":%lld,\"wall_s\":%.6f,"
+        "\"cpu_s\":{", atomic_load(&account->frames),
+        atomic_load(&account->bytes), wall);
+    long long total = 0;
+    for (int s = 0; s < ACCOUNT_NUM_STAGES; s++) {
+        long long ns = atomic_load(&account->cpuNs[s]);
+        total += ns;
+        fprintf(out, "\"%s\":%.6f,", stageNames[s], ns * 1e-9);
+    }
+    fprintf(out, "\"total\":%.6f},\"rusage\":{\"user_s\":%.6f,"
+        "\"sys_s\":%.6f,\"max_rss_kb\":%ld}}\n", total * 1e-9,
+        seconds(usage.ru_utime) - seconds(account->startUsage.ru_utime),
+        seconds(usage.ru_stime) - seconds(account->startUsage.ru_stime),
+        usage.ru_maxrss);
+    fflush(out);
+}
@@ -0,0 +1,77 @@
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Resources used by one render job, for charging it back: CPU time per
+// stage, frames and bytes produced. CPU time is read from the thread CPU
+// clock around each piece of work and added to the job that owns the work,
+// so jobs sharing a pool (or a process) are each charged only for their
+// own bands.
+typedef enum AccountStage {
+    ACCOUNT_TRACE,
+    ACCOUNT_DIFF,
+    ACCOUNT_ENCODE,
+    // Output: raw frames and the sinks writing the encoded stream.
+    ACCOUNT_WRITE,
+    ACCOUNT_NUM_STAGES
+} AccountStage;
+
+typedef struct JobAccount {
+    const char* name;
+    atomic_llong cpuNs[ACCOUNT_NUM_STAGES];
+    atomic_llong frames;
+    atomic_llong bytes;
+    // Taken by accountStart().
+    double startWall;
+    struct rusage startUsage;
+} JobAccount;
+
+void accountStart(JobAccount* account, const char* name);
+
+// CPU time used so far by the calling thread, in nanoseconds.
+static inline long long accountThreadNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Charge the calling thread's CPU time since startNs (from
+// accountThreadNs()) to stage.
+static inline void accountAdd(JobAccount* account, AccountStage stage,
+    long long startNs) {
+    
+    atomic_fetch_add_explicit(&account->cpuNs[stage],
+        accountThreadNs() - startNs, memory_order_relaxed);
+}
+
+// Same shape as cgif_write_fn and FanoutWriteFn.
+typedef int AccountWriteFn(void* context, const uint8_t* data,
+    const size_t numBytes);
+
+// Wraps an output's write function. countBytes adds what is written to the
+// job's bytes, and stage >= 0 charges the write's CPU time to that stage.
+// With several sinks for one stream, only one should count bytes.
+typedef struct AccountWriter {
+    JobAccount* account;
+    AccountWriteFn* fn;
+    void* context;
+    int countBytes;
+    int stage;
+} AccountWriter;
+
+// Write function taking an AccountWriter as its context.
+int accountWrite(void* context, const uint8_t* data, const size_t numBytes);
+
+// Append the job's record to out as one line of JSON: frames, bytes, wall
+// time, CPU seconds per stage and in total, and the process's rusage
+// since accountStart(). The rusage figures (including max_rss_kb, the
+// process's peak resident memory) cover every job in the process.
+void accountWriteRecord(const JobAccount* account, FILE* out);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "autotune.h"
+
+TuneParams tuneDefaults(int numThreads) {
+    return (TuneParams) {
+        .threads = numThreads > 0 ? numThreads : 1,
+        .bandRows = 8,
+        .traceDepth = 2,
+        .tileSize = 32
+    };
+}
+
+// Time params, log the trial and keep it in best if it is the fastest by
+// more than run-to-run noise.
+static void tryParams(TuneTrialFn* trial, void* arg, const TuneParams* params,
+    TuneParams* best, double* bestTime, FILE* log) {
+    
+    double t = trial(arg, params);
+    if (log) {
+        fprintf(log, "threads %2d, band rows %2d, trace depth %d, "
+            "tile size %2d: %8.3f ms/frame\n", params->threads,
+            params->bandRows, params->traceDepth, params->tileSize,
+            t * 1000.0);
+    }
+    if (t < *bestTime * 0.98) {
+        *bestTime = t;
+        *best = *params;
+    }
+}
+
+TuneParams tuneSearch(TuneTrialFn* trial, void* arg, int maxThreads,
+    FILE* log) {
+    
+    if (maxThreads < 1) maxThreads = 1;
+    TuneParams best = tuneDefaults(maxThreads);
+    double bestTime = 1e30;
+    // The first trial also warms up caches and lazily built tables, so it
+    // is run twice.
+    trial(arg, &best);
+    tryParams(trial, arg, &best, &best, &bestTime, log);
+    
+    // Powers of two below the CPU count, and the CPU count itself.
+    for (int n = 1; n < maxThreads; n *= 2) {
+        TuneParams p = best;
+        p.threads = n;
+        tryParams(trial, arg, &p, &best, &bestTime, log);
+    }
+    const int bandRows[] = { 2, 4, 16, 32 };
+    for (int i = 0; i < 4; i++) {
+        TuneParams p = best;
+        p.bandRows = bandRows[i];
+        tryParams(trial, arg, &p, &best, &bestTime, log);
+    }
+    const int traceDepths[] = { 1, 3 };
+    for (int i = 0; i < 2; i++) {
+        TuneParams p = best;
+        p.traceDepth = traceDepths[i];
+        tryParams(trial, arg, &p, &best, &bestTime, log);
+    }
+    const int tileSizes[] = { 16, 64 };
+    for (int i = 0; i < 2; i++) {
+        TuneParams p = best;
+        p.tileSize = tileSizes[i];
+        tryParams(trial, arg, &p, &best, &bestTime, log);
+    }
+    return best;
+}
+
+void tuneProfilePath(char* path, size_t size) {
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    
+    const char* config = getenv("XDG_CONFIG_HOME");
+    const char* home = getenv("HOME");
+    if (config && config[0])
+        snprintf(path, size, "%s/globe/%s.profile", config, host);
+    else
+        snprintf(path, size, "%s/.config/globe/%s.profile",
+            home ? home : ".", host);
+}
+
+// Parse "key threads=.. bandRows=.. traceDepth=.. tileSize=..".
+static int parseLine(const char* line, const char* key, TuneParams* params) {
+    size_t keyLen = strlen(key);
+    if (strncmp(line, key, keyLen) != 0 || line[keyLen] != ' ')
+        return 0;
+    TuneParams p;
+    if (sscanf(line + keyLen, " threads=%d bandRows=%d traceDepth=%d "
+        "tileSize=%d", &p.threads, &p.bandRows, &p.traceDepth,
+        &p.tileSize) != 4)
+        return 0;
+    if (p.threads < 1 || p.bandRows < 1 || p.traceDepth < 1 ||
+        p.tileSize < 1)
+        return 0;
+    *params = p;
+    return 1;
+}
+
+int tuneLoad(const char* path, const char* key, TuneParams* params) {
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+    char line[512];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), file))
+        found = parseLine(line, key, params);
+    fclose(file);
+    return found;
+}
+
+// mkdir -p of the directory holding path.
+static void makeParents(const char* path) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* slash = strchr(dir + 1, '/'); slash;
+        slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+}
+
+int tuneSave(const char* path, const char* key, const TuneParams* params) {
+    makeParents(path);
+    char tmpPath[4096 + 8];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE* out = fopen(tmpPath, "w");
+    if (!out)
+        return 0;
+    
+    // Keep the other workloads' entries. The profile is replaced with
+    // rename() so a concurrent run never reads half of it.
+    FILE* in = fopen(path, "r");
+    if (in) {
+        char line[512];
+        TuneParams old;
+        while (fgets(line, sizeof(line), in)) {
+            if (!parseLine(line, key, &old))
+                fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s threads=%d bandRows=%d traceDepth=%d tileSize=%d\n",
+        key, params->threads, params->bandRows, params->traceDepth,
+        params->tileSize);
+    
+    int ok = fclose(out) == 0;
+    if (ok && rename(tmpPath, path) != 0)
+        ok = 0;
+    if (!ok)
+        unlink(tmpPath);
+    return ok;
+}
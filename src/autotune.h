@@ -0,0 +1,44 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdio.h>
+
+// Settings that change how fast frames are made but not what they look
+// like. The best values depend on the machine (cores, caches, SMT) and on
+// the workload (resolution, scene), so they are found by timing trials.
+typedef struct TuneParams {
+    // Render pool size.
+    int threads;
+    // Rows per pool task (GlobeConfig.bandRows).
+    int bandRows;
+    // Frames traced at once by the pipeline.
+    int traceDepth;
+    // Tile size of the per-frame tile maps used for diffing.
+    int tileSize;
+} TuneParams;
+
+// Defaults for a machine with numThreads usable CPUs.
+TuneParams tuneDefaults(int numThreads);
+
+// Time a trial of the real workload with params, in seconds per frame.
+typedef double TuneTrialFn(void* arg, const TuneParams* params);
+
+// Coordinate search from tuneDefaults(): each setting in turn is swept
+// over its candidates while the others keep their best values so far.
+// Each trial is printed to log if it is not NULL. Returns the fastest.
+TuneParams tuneSearch(TuneTrialFn* trial, void* arg, int maxThreads,
+    FILE* log);
+
+// Per-machine profile: $XDG_CONFIG_HOME/globe/<hostname>.profile, or
+// ~/.config/globe/<hostname>.profile. One line per workload, keyed by a
+// string such as "500x500".
+void tuneProfilePath(char* path, size_t size);
+
+// Returns 0 if the profile has no entry for key.
+int tuneLoad(const char* path, const char* key, TuneParams* params);
+
+// Add or replace key's entry, creating the directory if needed. Returns 0
+// on failure.
+int tuneSave(const char* path, const char* key, const TuneParams* params);
+
+#endif
@@ -0,0 +1,1030 @@
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "cgif.h"
+
+#include "bench.h"
+#include "globe.h"
+#include "pool.h"
+#include "cpu_limits.h"
+#include "city_lights.h"
+#include "earth_data.h"
+#include "topology.h"
+#include "pipeline.h"
+#include "geometry.h"
+#include "shade.h"
+#include "gif_edit.h"
+#include "accounting.h"
+#include "cube_map.h"
+#include "frame_store.h"
+#include "color_texture.h"
+#include "render_queue.h"
+
+double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct BenchCase {
+    const char* name;
+    GlobeConfig config;
+} BenchCase;
+
+// Render numFrames frames of one rotation and return milliseconds per frame.
+static double timeFrames(Pool* pool, uint8_t* screen, int width, int height,
+    int numFrames, const GlobeConfig* config) {
+    
+    double start = benchNow();
+    for (int i = 0; i < numFrames; i++)
+        traceGlobeParallel(pool, screen, width, height, i, numFrames, config,
+            NULL);
+    return (benchNow() - start) * 1000.0 / numFrames;
+}
+
+// Bounding rectangle of the pixels that differ between two frames, found
+// the way a frame-difference encoder does without help: compare them all.
+static TileRect compareFrames(const uint8_t* prev, const uint8_t* cur,
+    int width, int height) {
+    
+    int x0 = width, y0 = height, x1 = -1, y1 = -1;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* a = prev + y * width;
+        const uint8_t* b = cur + y * width;
+        if (memcmp(a, b, width) == 0) continue;
+        // Only scan in from each end as far as the first difference.
+        int l = 0, r = width - 1;
+        while (a[l] == b[l]) l++;
+        while (a[r] == b[r]) r--;
+        if (l < x0) x0 = l;
+        if (r > x1) x1 = r;
+        if (y < y0) y0 = y;
+        y1 = y;
+    }
+    if (x1 < 0)
+        return (TileRect) { 0, 0, 0, 0 };
+    return (TileRect) { x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+}
+
+// Cost of finding each frame's changed region: a full compare against the
+// previous frame versus comparing tile maps written by the renderer, and
+// what writing the tile maps adds to rendering.
+static void benchDiff(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    const int tileSize = 32;
+    size_t frameSize = (size_t) width * height;
+    uint8_t* frames[2] = {
+        (uint8_t*) malloc(frameSize), (uint8_t*) malloc(frameSize)
+    };
+    TileMap* maps[2] = {
+        tileMapCreate(width, height, tileSize),
+        tileMapCreate(width, height, tileSize)
+    };
+    
+    double renderPlain = 0.0, renderTiles = 0.0;
+    double diffFull = 0.0, diffTiles = 0.0;
+    long long fullArea = 0, tileArea = 0;
+    int contained = 1;
+    for (int i = 0; i < numFrames; i++) {
+        uint8_t* cur = frames[i & 1];
+        uint8_t* prev = frames[~i & 1];
+        
+        double t0 = benchNow();
+        traceGlobeParallel(pool, cur, width, height, i, numFrames, config,
+            NULL);
+        double t1 = benchNow();
+        traceGlobeParallel(pool, cur, width, height, i, numFrames, config,
+            maps[i & 1]);
+        double t2 = benchNow();
+        renderPlain += t1 - t0;
+        renderTiles += t2 - t1;
+        if (i == 0) continue;
+        
+        TileRect full = compareFrames(prev, cur, width, height);
+        double t3 = benchNow();
+        TileRect tiled = tileMapDirtyRect(maps[~i & 1], maps[i & 1]);
+        double t4 = benchNow();
+        diffFull += t3 - t2;
+        diffTiles += t4 - t3;
+        fullArea += (long long) full.width * full.height;
+        tileArea += (long long) tiled.width * tiled.height;
+        
+        // The tile rectangle must cover every changed pixel.
+        if (full.width > 0 && (full.x < tiled.x || full.y < tiled.y ||
+            full.x + full.width > tiled.x + tiled.width ||
+            full.y + full.height > tiled.y + tiled.height))
+            contained = 0;
+    }
+    
+    int numDiffs = numFrames - 1;
+    printf("frame diff (%dx%d tiles): full compare %.1f us/frame, "
+        "tile maps %.1f us/frame\n", tileSize, tileSize,
+        diffFull * 1e6 / numDiffs, diffTiles * 1e6 / numDiffs);
+    printf("  tile hashing adds %.3f ms/frame to rendering; dirty area "
+        "%lld px exact, %lld px by tiles%s\n",
+        (renderTiles - renderPlain) * 1000.0 / numFrames,
+        fullArea / numDiffs, tileArea / numDiffs,
+        contained ? "" : " (TILES MISSED CHANGES)");
+    
+    for (int k = 0; k < 2; k++) {
+        tileMapFree(maps[k]);
+        free(frames[k]);
+    }
+}
+
+// GIF output that is thrown away, so that encoding and not the disk is
+// timed.
+static int discardWrite(void* context, const uint8_t* data, size_t size) {
+    return 0;
+}
+
+typedef struct PipelineBench {
+    Pool* pool;
+    const GlobeConfig* config;
+    int width, height, numFrames;
+    uint8_t* frames;
+    CGIF* gif;
+    CGIF_FrameConfig frameConfig;
+} PipelineBench;
+
+static void benchTraceStage(void* arg, int frame, int slot) {
+    PipelineBench* b = (PipelineBench*) arg;
+    traceGlobeParallel(b->pool, b->frames + (size_t) slot * b->width *
+        b->height, b->width, b->height, frame, b->numFrames, b->config, NULL);
+}
+
+static void benchEncodeStage(void* arg, int frame, int slot) {
+    PipelineBench* b = (PipelineBench*) arg;
+    b->frameConfig.pImageData = b->frames + (size_t) slot * b->width *
+        b->height;
+    cgif_addframe(b->gif, &b->frameConfig);
+}
+
+// Trace and encode numFrames frames with threads placed as planned and the
+// encoder in a pipeline stage of its own. Returns milliseconds per frame
+// and the fraction of the time the encoder was busy.
+static double timePipeline(int width, int height, int numFrames,
+    const GlobeConfig* config, const ThreadPlacement* plan,
+    uint8_t* palette, double* encodeBusy) {
+    
+    const int numSlots = 3;
+    Pool* pool = poolCreate(plan->numRender);
+    poolPin(pool, plan->renderCpus);
+    CGIF_Config gifConfig = {
+        .pGlobalPalette = palette,
+        .attrFlags = CGIF_ATTR_IS_ANIMATED,
+        .width = width,
+        .height = height,
+        .numGlobalPaletteEntries = GLOBE_NUM_COLORS,
+        .pWriteFn = discardWrite
+    };
+    PipelineBench b = {
+        pool, config, width, height, numFrames,
+        (uint8_t*) malloc((size_t) numSlots * width * height),
+        cgif_newgif(&gifConfig), { .delay = 3 }
+    };
+    PipelineStage stages[] = {
+        { "trace", benchTraceStage, &b, 2, 0, -1 },
+        { "encode", benchEncodeStage, &b, 1, 1, plan->encodeCpu }
+    };
+    PipelineStats stats[2];
+    double elapsed = pipelineRun(stages, 2, numFrames, numSlots, stats);
+    
+    cgif_close(b.gif);
+    free(b.frames);
+    poolDestroy(pool);
+    *encodeBusy = stats[1].utilization;
+    return elapsed * 1000.0 / numFrames;
+}
+
+// Compare render/encode thread placements on this machine's topology.
+static void benchPlacement(int width, int height, int numFrames,
+    int numThreads, const GlobeConfig* config) {
+    
+    CpuTopology topology;
+    cpuTopologyRead(&topology);
+    int smt = 0;
+    for (int k = 0; k < topology.numCores; k++)
+        if (topology.cores[k].numThreads > smt)
+            smt = topology.cores[k].numThreads;
+    printf("render + encode: %d CPUs on %d cores, up to %d threads per core\n",
+        topology.numCpus, topology.numCores, smt);
+    printf("%-24s %10s %10s %10s %12s\n", "placement", "render", "ms/frame",
+        "relative", "encode busy");
+    
+    // Palette contents do not matter to the encoder's speed.
+    uint8_t palette[GLOBE_NUM_COLORS * 3] = { 0 };
+    Placement placements[] = {
+        PLACEMENT_NAIVE, PLACEMENT_SMT_PAIR, PLACEMENT_ONE_PER_CORE
+    };
+    double base = 0.0;
+    for (int i = 0; i < 3; i++) {
+        ThreadPlacement plan;
+        placementPlan(&topology, placements[i], numThreads, &plan);
+        double busy;
+        double ms = timePipeline(width, height, numFrames, config, &plan,
+            palette, &busy);
+        if (i == 0) base = ms;
+        printf("%-24s %10d %10.3f %9.2fx %11.0f%%\n",
+            placementName(placements[i]), plan.numRender, ms, ms / base,
+            busy * 100.0);
+        placementFree(&plan);
+    }
+    cpuTopologyFree(&topology);
+}
+
+// Size of the geometry tables and how many pixels the cached normals
+// change against traced frames.
+static void benchGeometry(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    GlobeConfig cached = *config;
+    cached.geometryCache = 1;
+    size_t frameSize = (size_t) width * height;
+    uint8_t* traced = (uint8_t*) malloc(frameSize);
+    uint8_t* fromTable = (uint8_t*) malloc(frameSize);
+    long long mismatched = 0;
+    for (int i = 0; i < numFrames; i++) {
+        traceGlobeParallel(pool, traced, width, height, i, numFrames, config,
+            NULL);
+        traceGlobeParallel(pool, fromTable, width, height, i, numFrames,
+            &cached, NULL);
+        for (size_t k = 0; k < frameSize; k++)
+            mismatched += traced[k] != fromTable[k];
+    }
+    free(traced);
+    free(fromTable);
+    
+    GeometryKey key = { config->camera, cameraDefaultFov(config->camera),
+        config->cameraDistance, config->equatorialRadius, width, height };
+    const GeometryTable* table = geometryTableFind(&key);
+    printf("geometry table: %zu bytes stored, %zu for the full frame; "
+        "%.4f%% of pixels differ from traced frames\n",
+        table ? geometryTableBytes(table) : 0,
+        frameSize * 3 * sizeof(float),
+        100.0 * mismatched / ((double) numFrames * frameSize));
+    // Same ratio at 16K: a quadrant is (8192 + 1)^2 entries.
+    printf("geometry table at 16384x16384: %.0f MB quadrant, %.0f MB full\n",
+        8193.0 * 8193.0 * 12.0 / 1e6, 16384.0 * 16384.0 * 12.0 / 1e6);
+}
+
+// Startup latency of the geometry tables shared through /dev/shm: one
+// process misses and builds them, the ones after it map them. Each
+// renders a frame in a child process, as separate renders on a host would.
+static void benchSharedGeometry(int width, int height,
+    const GlobeConfig* config) {
+    
+    char dir[] = "/dev/shm/globe-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("shared geometry: /dev/shm not available\n");
+        return;
+    }
+    GlobeConfig shared = *config;
+    shared.geometryCache = 1;
+    shared.geometryDir = dir;
+    
+    const char* names[] = { "miss", "hit", "hit" };
+    for (int i = 0; i < 3; i++) {
+        int fds[2];
+        if (pipe(fds) != 0)
+            break;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            uint8_t* screen = (uint8_t*) malloc((size_t) width * height);
+            double start = benchNow();
+            traceGlobe(screen, width, height, 0, 1, &shared);
+            double first = benchNow() - start;
+            GeometryCacheStats stats;
+            geometryCacheStats(&stats);
+            double result[3] = {
+                stats.sharedHits ? stats.hitSeconds : stats.missSeconds,
+                first, stats.sharedHits
+            };
+            ssize_t written = write(fds[1], result, sizeof(result));
+            _exit(written == sizeof(result) ? 0 : 1);
+        }
+        close(fds[1]);
+        double result[3];
+        ssize_t got = pid > 0 ? read(fds[0], result, sizeof(result)) : -1;
+        close(fds[0]);
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+        if (got != sizeof(result))
+            break;
+        printf("shared geometry, process %d (%s%s): tables in %.3f ms, "
+            "first frame in %.3f ms\n", i + 1, names[i],
+            (result[2] > 0) == (i > 0) ? "" : ", unexpected",
+            result[0] * 1000.0, result[1] * 1000.0);
+    }
+    
+    DIR* entries = opendir(dir);
+    struct dirent* entry;
+    while (entries && (entry = readdir(entries))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char path[sizeof(dir) + 256];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (entries)
+        closedir(entries);
+    rmdir(dir);
+}
+
+// Texture memory and sampling throughput of the cube map against
+// earthData, over the normals of an orthographic view of the globe visited
+// in screen order, as traceGlobe() visits them. Also counts the samples
+// that land on the other side of a coastline.
+static void benchCubeMap(int width, int height) {
+    cubeMapInit();
+    int size = width < height ? width : height;
+    Vec3* normals = (Vec3*) malloc((size_t) size * size * sizeof(Vec3));
+    int numNormals = 0;
+    // A spin and tilt so the poles and a face edge are in view.
+    double spin = 0.4, tilt = 0.5;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            double px = (x + 0.5) * 2.0 / size - 1.0;
+            double py = 1.0 - (y + 0.5) * 2.0 / size;
+            double r2 = px * px + py * py;
+            if (r2 >= 1.0)
+                continue;
+            Vec3 n = { px, py, sqrt(1.0 - r2) };
+            n = (Vec3) { n.x, n.y * cos(tilt) - n.z * sin(tilt),
+                n.y * sin(tilt) + n.z * cos(tilt) };
+            normals[numNormals++] = vrotzx(n, cos(spin), sin(spin));
+        }
+    }
+    
+    int rounds = 20;
+    long long equirectLand = 0, cubeLand = 0, differ = 0;
+    double start = benchNow();
+    for (int k = 0; k < rounds; k++) {
+        for (int i = 0; i < numNormals; i++)
+            equirectLand += sampleEarthData(
+                texCoordX(normals[i], EARTH_DATA_WIDTH),
+                texCoordY(normals[i], EARTH_DATA_HEIGHT));
+    }
+    double equirect = benchNow() - start;
+    start = benchNow();
+    for (int k = 0; k < rounds; k++) {
+        for (int i = 0; i < numNormals; i++)
+            cubeLand += cubeMapSample(cubeMapLand,
+                cubeMapTexel(normals[i]));
+    }
+    double cube = benchNow() - start;
+    for (int i = 0; i < numNormals; i++)
+        differ += sampleEarthData(texCoordX(normals[i], EARTH_DATA_WIDTH),
+            texCoordY(normals[i], EARTH_DATA_HEIGHT)) !=
+            cubeMapSample(cubeMapLand, cubeMapTexel(normals[i]));
+    free(normals);
+    
+    double samples = (double) numNormals * rounds;
+    printf("cube map: %zu bytes against %zu equirectangular; "
+        "%.1f M samples/s against %.1f M (%.2fx); %.3f%% of samples "
+        "differ (land %.3f%% vs %.3f%%)\n", cubeMapBytes(),
+        (size_t) EARTH_DATA_SIZE * sizeof(uint64_t), samples / cube / 1e6,
+        samples / equirect / 1e6, equirect / cube,
+        100.0 * differ / numNormals, 100.0 * cubeLand / samples,
+        100.0 * equirectLand / samples);
+}
+
+typedef struct ScanlineCheck {
+    int width;
+    int nextRow;
+    int outOfOrder;
+    const uint8_t* screen;
+} ScanlineCheck;
+
+static void checkRows(void* arg, const uint8_t* rows, int y0, int y1) {
+    ScanlineCheck* check = (ScanlineCheck*) arg;
+    if (y0 != check->nextRow || rows != check->screen +
+        (size_t) y0 * check->width)
+        check->outOfOrder++;
+    check->nextRow = y1;
+}
+
+// Latency of the scanline mode: time to the first and last rows handed to
+// the callback, against a whole frame (where both are the frame time).
+// Also checks that rows arrive in order and match a full frame.
+static void benchScanlines(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    size_t frameSize = (size_t) width * height;
+    uint8_t* full = (uint8_t*) malloc(frameSize);
+    uint8_t* rows = (uint8_t*) malloc(frameSize);
+    double whole = 0.0, first = 0.0, last = 0.0;
+    long long mismatched = 0;
+    int outOfOrder = 0;
+    for (int i = 0; i < numFrames; i++) {
+        double start = benchNow();
+        traceGlobeParallel(pool, full, width, height, i, numFrames, config,
+            NULL);
+        whole += benchNow() - start;
+        
+        ScanlineCheck check = { width, 0, 0, rows };
+        GlobeScanlineStats stats;
+        traceGlobeScanlines(pool, rows, width, height, i, numFrames, config,
+            checkRows, &check, &stats);
+        first += stats.firstRow;
+        last += stats.lastRow;
+        outOfOrder += check.outOfOrder + (check.nextRow != height);
+        mismatched += memcmp(full, rows, frameSize) != 0;
+    }
+    free(full);
+    free(rows);
+    printf("scanlines: first row after %.3f ms, last after %.3f ms; whole "
+        "frame %.3f ms; %d out of order, %lld frames differ\n",
+        first * 1000.0 / numFrames, last * 1000.0 / numFrames,
+        whole * 1000.0 / numFrames, outOfOrder, mismatched);
+}
+
+// Frame store for scrubbing: compressed size and the time to compress and
+// decode a frame, against rendering it; then hits and evictions scrubbing
+// back and forth over the rotation with room for a quarter of it.
+static void benchFrameStore(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    size_t frameSize = (size_t) width * height;
+    uint8_t* frames = (uint8_t*) malloc(frameSize * numFrames);
+    uint8_t* out = (uint8_t*) malloc(frameSize);
+    double render = benchNow();
+    for (int i = 0; i < numFrames; i++)
+        traceGlobeParallel(pool, frames + i * frameSize, width, height, i,
+            numFrames, config, NULL);
+    render = benchNow() - render;
+    
+    FrameStore* store = frameStoreCreate(width, height, (size_t) -1);
+    double put = benchNow();
+    for (int i = 0; i < numFrames; i++)
+        frameStorePut(store, i, frames + i * frameSize);
+    put = benchNow() - put;
+    FrameStoreStats stats;
+    frameStoreStats(store, &stats);
+    size_t total = stats.bytes;
+    // Visit frames out of order, as a scrub would.
+    int rounds = 10;
+    long long mismatched = 0;
+    double get = benchNow();
+    for (int k = 0; k < rounds * numFrames; k++) {
+        int i = (int) ((k * 7919LL) % numFrames);
+        frameStoreGet(store, i, out);
+        mismatched += memcmp(out, frames + i * frameSize, frameSize) != 0;
+    }
+    get = benchNow() - get;
+    frameStoreFree(store);
+    printf("frame store: %.1f KB per frame (%.1f%% of raw), compressed in "
+        "%.1f us, decoded in %.1f us, rendered in %.1f us; %lld differ\n",
+        total / 1e3 / numFrames, 100.0 * total / (frameSize * numFrames),
+        put * 1e6 / numFrames, get * 1e6 / (rounds * numFrames),
+        render * 1e6 / numFrames, mismatched);
+    
+    // Sweep forward and back over overlapping windows, rendering (here,
+    // copying) misses into the store.
+    store = frameStoreCreate(width, height, total / 4);
+    for (int pass = 0; pass < 4; pass++) {
+        int first = pass * numFrames / 8;
+        int window = numFrames / 4;
+        for (int step = 0; step < 2 * window; step++) {
+            int i = first + (step < window ? step : 2 * window - 1 - step);
+            if (!frameStoreGet(store, i, out))
+                frameStorePut(store, i, frames + i * frameSize);
+        }
+    }
+    frameStoreStats(store, &stats);
+    printf("frame store, scrubbing with a quarter of the frames' bytes: "
+        "%lld hits, %lld misses, %lld evictions, %zu of %zu bytes used\n",
+        stats.hits, stats.misses, stats.evictions, stats.bytes, total / 4);
+    frameStoreFree(store);
+    free(frames);
+    free(out);
+}
+
+// Per-pixel cost of full-color rendering against the 1-bit land mask, and
+// of quantizing through the lookup table against searching the palette.
+static void benchColor(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    uint8_t palette[COLOR_PALETTE_SIZE * 3];
+    colorPaletteBuild(palette, globePalette, GLOBE_NUM_COLORS);
+    int numColors = COLOR_PALETTE_SIZE - GLOBE_NUM_COLORS;
+    ColorLut* lut = (ColorLut*) malloc(sizeof(ColorLut));
+    double build = benchNow();
+    colorLutBuild(lut, palette, GLOBE_NUM_COLORS, numColors);
+    build = benchNow() - build;
+    ColorTexture* texture = colorTextureProcedural();
+    
+    // Globe pixels per frame, from the first frame.
+    size_t frameSize = (size_t) width * height;
+    uint8_t* screen = (uint8_t*) malloc(frameSize);
+    traceGlobeParallel(pool, screen, width, height, 0, numFrames, config,
+        NULL);
+    long long globePixels = 0;
+    for (size_t k = 0; k < frameSize; k++)
+        globePixels += screen[k] != 0;
+    
+    GlobeConfig colored = *config;
+    colored.texture = texture;
+    colored.colorLut = lut;
+    GlobeConfig dithered = colored;
+    dithered.dither = 1;
+    double mask = timeFrames(pool, screen, width, height, numFrames, config);
+    double lookup = timeFrames(pool, screen, width, height, numFrames,
+        &colored);
+    double diffused = timeFrames(pool, screen, width, height, numFrames,
+        &dithered);
+    
+    // The table against the exhaustive search it replaces, over random
+    // colors.
+    int samples = 100000;
+    uint32_t seed = 1;
+    volatile uint8_t sink = 0;
+    long long differ = 0;
+    double searchTime = benchNow();
+    for (int k = 0; k < samples; k++) {
+        seed = seed * 1664525u + 1013904223u;
+        sink = colorNearest(palette, GLOBE_NUM_COLORS, numColors,
+            seed >> 24, (seed >> 16) & 255, (seed >> 8) & 255);
+    }
+    searchTime = benchNow() - searchTime;
+    double lookupTime = benchNow();
+    seed = 1;
+    for (int k = 0; k < samples; k++) {
+        seed = seed * 1664525u + 1013904223u;
+        sink = colorLutIndex(lut, seed >> 24, (seed >> 16) & 255,
+            (seed >> 8) & 255);
+    }
+    lookupTime = benchNow() - lookupTime;
+    seed = 1;
+    for (int k = 0; k < samples; k++) {
+        seed = seed * 1664525u + 1013904223u;
+        int r = seed >> 24, g = (seed >> 16) & 255, b = (seed >> 8) & 255;
+        differ += colorLutIndex(lut, r, g, b) !=
+            colorNearest(palette, GLOBE_NUM_COLORS, numColors, r, g, b);
+    }
+    (void) sink;
+    
+    printf("color: 1-bit %.1f ns, color %.1f ns, dithered %.1f ns per globe "
+        "pixel (frame %.3f / %.3f / %.3f ms)\n",
+        mask * 1e6 / globePixels, lookup * 1e6 / globePixels,
+        diffused * 1e6 / globePixels, mask, lookup, diffused);
+    printf("color table: built in %.2f ms; %.1f ns per lookup against %.1f "
+        "ns searching %d colors; %.2f%% of colors pick another entry\n",
+        build * 1000.0, lookupTime * 1e9 / samples,
+        searchTime * 1e9 / samples, numColors, 100.0 * differ / samples);
+    colorTextureFree(texture);
+    free(lut);
+    free(screen);
+}
+
+// Cost of the shading stage alone: turning each pixel's hit, land and
+// brightness into a palette index one pixel at a time with branches, as
+// traceGlobe() does, versus setting bitplane bits and expanding a row at
+// a time. The per-pixel decisions are taken from traced frames. Also
+// checks that bit-sliced frames match.
+static void benchShading(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    size_t frameSize = (size_t) width * height;
+    uint8_t* frame = (uint8_t*) malloc(frameSize);
+    uint8_t* sliced = (uint8_t*) malloc(frameSize);
+    uint8_t* out = (uint8_t*) malloc(frameSize);
+    uint8_t* hit = (uint8_t*) malloc(frameSize);
+    uint8_t* land = (uint8_t*) malloc(frameSize);
+    uint8_t* bright = (uint8_t*) malloc(frameSize);
+    GlobeConfig slicedConfig = *config;
+    slicedConfig.bitSliced = 1;
+    ShadePlanes* planes = shadePlanesCreate(width);
+    
+    double perPixel = 0.0, setBits = 0.0, expandBits = 0.0;
+    long long mismatched = 0;
+    for (int f = 0; f < numFrames; f++) {
+        traceGlobeParallel(pool, frame, width, height, f, numFrames, config,
+            NULL);
+        traceGlobeParallel(pool, sliced, width, height, f, numFrames,
+            &slicedConfig, NULL);
+        for (size_t i = 0; i < frameSize; i++) {
+            mismatched += frame[i] != sliced[i];
+            hit[i] = frame[i] >= 1 && frame[i] <= 8;
+            land[i] = frame[i] >= 5 && frame[i] <= 8;
+            bright[i] = hit[i] ? (frame[i] - 1) & 3 : 0;
+        }
+        
+        double t0 = benchNow();
+        for (size_t i = 0; i < frameSize; i++) {
+            if (hit[i])
+                out[i] = 1 + 4 * land[i] + bright[i];
+            else
+                out[i] = 0;
+        }
+        double t1 = benchNow();
+        // Set bits the way traceGlobe() does, pixel by pixel.
+        double set = 0.0, expand = 0.0;
+        for (int y = 0; y < height; y++) {
+            size_t row = (size_t) y * width;
+            double t2 = benchNow();
+            shadeClear(planes);
+            for (int x = 0; x < width; x++) {
+                size_t i = row + x;
+                shadeSet(planes->hit, x, hit[i]);
+                shadeSet(planes->land, x, land[i]);
+                shadeSet(planes->bright0, x, bright[i] & 1);
+                shadeSet(planes->bright1, x, bright[i] >> 1);
+            }
+            double t3 = benchNow();
+            shadeExpand(planes, out + row);
+            double t4 = benchNow();
+            set += t3 - t2;
+            expand += t4 - t3;
+        }
+        perPixel += t1 - t0;
+        setBits += set;
+        expandBits += expand;
+    }
+    
+    double pixels = (double) numFrames * frameSize;
+    printf("shading stage: per pixel %.3f ns/pixel, bit-sliced %.3f "
+        "ns/pixel setting bits + %.3f ns/pixel %s expand; %lld pixels "
+        "differ\n", perPixel * 1e9 / pixels, setBits * 1e9 / pixels,
+        expandBits * 1e9 / pixels,
+#if defined(__SSE2__)
+        "SSE2",
+#else
+        "scalar",
+#endif
+        mismatched);
+    
+    shadePlanesFree(planes);
+    free(frame);
+    free(sliced);
+    free(out);
+    free(hit);
+    free(land);
+    free(bright);
+}
+
+// Getting the animation at a different speed and in reverse: rendering
+// and encoding it again versus editing the finished GIF's blocks.
+static void benchEdit(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    char renderPath[64], editPath[64];
+    snprintf(renderPath, sizeof(renderPath), "/tmp/globe-bench-%d.gif",
+        (int) getpid());
+    snprintf(editPath, sizeof(editPath), "/tmp/globe-bench-%d-edit.gif",
+        (int) getpid());
+    
+    uint8_t palette[GLOBE_NUM_COLORS * 3];
+    memcpy(palette, globePalette, sizeof(palette));
+    CGIF_Config gifConfig = {
+        .pGlobalPalette = palette,
+        .path = renderPath,
+        .attrFlags = CGIF_ATTR_IS_ANIMATED,
+        .width = width,
+        .height = height,
+        .numGlobalPaletteEntries = GLOBE_NUM_COLORS
+    };
+    CGIF_FrameConfig frameConfig = { .delay = 3 };
+    uint8_t* screen = (uint8_t*) malloc((size_t) width * height);
+    
+    double t0 = benchNow();
+    CGIF* gif = cgif_newgif(&gifConfig);
+    if (!gif) {
+        free(screen);
+        return;
+    }
+    for (int i = 0; i < numFrames; i++) {
+        traceGlobeParallel(pool, screen, width, height, i, numFrames, config,
+            NULL);
+        frameConfig.pImageData = screen;
+        cgif_addframe(gif, &frameConfig);
+    }
+    cgif_close(gif);
+    double t1 = benchNow();
+    
+    GifFile* file = gifOpen(renderPath);
+    int* order = (int*) malloc(numFrames * sizeof(int));
+    for (int i = 0; i < numFrames; i++)
+        order[i] = numFrames - 1 - i;
+    GifEdit edit = { .delay = 6, .order = order, .numOrder = numFrames };
+    int result = file ? gifEditWrite(file, &edit, editPath) : -1;
+    if (file) gifClose(file);
+    double t2 = benchNow();
+    
+    printf("retime + reverse: re-render %.3f ms, GIF edit %.3f ms (%s)\n",
+        (t1 - t0) * 1000.0, (t2 - t1) * 1000.0,
+        result == 0 ? "ok" : "failed");
+    unlink(renderPath);
+    unlink(editPath);
+    free(order);
+    free(screen);
+}
+
+typedef struct AccountedJob {
+    Pool* pool;
+    GlobeConfig config;
+    JobAccount account;
+    int width, height, numFrames;
+} AccountedJob;
+
+static void* accountedJobThread(void* arg) {
+    AccountedJob* job = (AccountedJob*) arg;
+    uint8_t* screen = (uint8_t*) malloc((size_t) job->width * job->height);
+    for (int i = 0; i < job->numFrames; i++)
+        traceGlobeParallel(job->pool, screen, job->width, job->height, i,
+            job->numFrames, &job->config, NULL);
+    free(screen);
+    return NULL;
+}
+
+static double cpuSeconds(const struct rusage* usage) {
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec * 1e-6 +
+        usage->ru_stime.tv_sec + usage->ru_stime.tv_usec * 1e-6;
+}
+
+// What per-job accounting costs, and whether two jobs sharing one pool
+// are each charged for their own bands: the jobs' CPU time should add up
+// to the process's.
+static void benchAccounting(Pool* pool, int width, int height, int numFrames,
+    const GlobeConfig* config) {
+    
+    uint8_t* screen = (uint8_t*) malloc((size_t) width * height);
+    JobAccount account;
+    accountStart(&account, "bench");
+    GlobeConfig accounted = *config;
+    accounted.account = &account;
+    // Alternate the two so drift in the machine's speed affects both.
+    double plain = 0.0, charged = 0.0;
+    for (int round = 0; round < 2; round++) {
+        plain += timeFrames(pool, screen, width, height, numFrames, config);
+        charged += timeFrames(pool, screen, width, height, numFrames,
+            &accounted);
+    }
+    free(screen);
+    
+    AccountedJob jobs[2];
+    for (int j = 0; j < 2; j++) {
+        jobs[j] = (AccountedJob) {
+            pool, *config, { 0 }, width, height, numFrames
+        };
+        accountStart(&jobs[j].account, j == 0 ? "a" : "b");
+        jobs[j].config.account = &jobs[j].account;
+    }
+    // The second job has lights on, so the two cost different amounts.
+    jobs[1].config.cityLights = 1;
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    pthread_t threads[2];
+    for (int j = 0; j < 2; j++)
+        pthread_create(&threads[j], NULL, accountedJobThread, &jobs[j]);
+    for (int j = 0; j < 2; j++)
+        pthread_join(threads[j], NULL);
+    getrusage(RUSAGE_SELF, &after);
+    
+    double a = atomic_load(&jobs[0].account.cpuNs[ACCOUNT_TRACE]) * 1e-9;
+    double b = atomic_load(&jobs[1].account.cpuNs[ACCOUNT_TRACE]) * 1e-9;
+    printf("accounting: %.2f%% overhead; two jobs on one pool charged "
+        "%.3f s + %.3f s = %.3f s of %.3f s process CPU\n",
+        100.0 * (charged - plain) / plain, a, b, a + b,
+        cpuSeconds(&after) - cpuSeconds(&before));
+}
+
+// The non-blocking queue: how long renderSubmit() holds the caller, and
+// the whole rotation as one job waited for on the eventfd against
+// rendering it frame by frame. A second job is cancelled straight away.
+static void benchRenderQueue(Pool* pool, int width, int height,
+    int numFrames, const GlobeConfig* config) {
+    
+    RenderQueue* queue = renderQueueCreate(pool);
+    if (!queue) {
+        printf("render queue: eventfd not available\n");
+        return;
+    }
+    size_t frameSize = (size_t) width * height;
+    uint8_t* direct = (uint8_t*) malloc(frameSize * numFrames);
+    uint8_t* queued = (uint8_t*) malloc(frameSize * numFrames);
+    double start = benchNow();
+    for (int i = 0; i < numFrames; i++)
+        traceGlobeParallel(pool, direct + i * frameSize, width, height, i,
+            numFrames, config, NULL);
+    double whole = benchNow() - start;
+    
+    RenderRequest request = {
+        queued, width, height, numFrames, 0.0, 1.0, numFrames, *config, NULL
+    };
+    start = benchNow();
+    RenderJob* job = renderSubmit(queue, &request);
+    double submit = benchNow() - start;
+    RenderJob* done = renderQueueWait(queue);
+    double rendered = benchNow() - start;
+    long long mismatched = 0;
+    for (int i = 0; i < numFrames; i++)
+        mismatched += memcmp(direct + i * frameSize, queued + i * frameSize,
+            frameSize) != 0;
+    int ok = done == job && renderJobStatus(done) == RENDER_DONE;
+    renderJobFree(done);
+    
+    job = renderSubmit(queue, &request);
+    renderCancel(job);
+    done = renderQueueWait(queue);
+    RenderStatus cancelled = renderJobStatus(done);
+    renderJobFree(done);
+    
+    free(direct);
+    free(queued);
+    renderQueueDestroy(queue);
+    printf("render queue: submit %.1f us, %.3f ms/frame against %.3f "
+        "direct; %lld frames differ%s; cancelled job %s\n", submit * 1e6,
+        rendered * 1000.0 / numFrames, whole * 1000.0 / numFrames,
+        mismatched, ok ? "" : ", job not done",
+        cancelled == RENDER_CANCELLED ? "cancelled" : "finished first");
+}
+
+// Config with a moon-like occluder of radius rm casting a shadow onto the
+// middle of the visible day side.
+static GlobeConfig eclipseConfig(double rm) {
+    Vec3 toSun = vscl(GLOBE_LIGHT, -1.0 / sqrt(vmag2(GLOBE_LIGHT)));
+    return (GlobeConfig) {
+        .equatorialRadius = 1.0,
+        .polarRadius = 1.0,
+        .cameraDistance = 2.2,
+        .occluderCenter = vsum(vscl(toSun, 30.0), (Vec3) { 0.0, 0.3, 0.0 }),
+        .occluderRadius = rm,
+        .sunRadius = 0.266
+    };
+}
+
+void runBenchmark(int width, int height, int numFrames, int numThreads) {
+    BenchCase cases[] = {
+        { "sphere", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2
+        } },
+        { "ellipsoid (WGS84)", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0 - WGS84_FLATTENING,
+            .cameraDistance = 2.2
+        } },
+        { "ellipsoid (f = 0.2)", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 0.8,
+            .cameraDistance = 2.2
+        } },
+        { "sphere + rings", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 5.0,
+            .pitch = 20.0,
+            .ringInner = 1.25,
+            .ringOuter = 2.3
+        } },
+        { "sphere, far camera", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 5.0,
+            .pitch = 20.0
+        } },
+        { "sphere + city lights", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .cityLights = 1
+        } },
+        { "fisheye 180 (ray table)", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_FISHEYE
+        } },
+        { "fisheye 70 (ray table)", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_FISHEYE,
+            .fov = 70.0
+        } },
+        { "panoramic 60 (ray table)", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_PANORAMIC,
+            .fov = 60.0
+        } },
+        { "orthographic", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_ORTHOGRAPHIC
+        } },
+        { "orthographic, WGS84", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0 - WGS84_FLATTENING,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_ORTHOGRAPHIC
+        } },
+        { "sphere, geometry cache", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .geometryCache = 1
+        } },
+        { "fisheye 180, geom. cache", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .camera = CAMERA_FISHEYE,
+            .geometryCache = 1
+        } },
+        { "sphere, cube map", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .cubeMap = 1
+        } },
+        { "sphere, bit-sliced", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .bitSliced = 1
+        } },
+        { "city lights, bit-sliced", {
+            .equatorialRadius = 1.0,
+            .polarRadius = 1.0,
+            .cameraDistance = 2.2,
+            .cityLights = 1,
+            .bitSliced = 1
+        } },
+        { "eclipse, moon r = 0.05", eclipseConfig(0.05) },
+        { "eclipse, moon r = 0.15", eclipseConfig(0.15) },
+        { "eclipse, moon r = 0.3", eclipseConfig(0.3) },
+        { "eclipse, moon r = 0.6", eclipseConfig(0.6) }
+    };
+    int numCases = sizeof(cases) / sizeof(cases[0]);
+    
+    CpuLimits limits;
+    cpuLimitsRead(&limits);
+    if (numThreads < 1) numThreads = limits.threads;
+    Pool* pool = poolCreate(numThreads);
+    
+    uint8_t* screen = (uint8_t*) malloc(width * height * sizeof(uint8_t));
+    printf("%dx%d, %d frames, %d threads "
+        "(online %d, cpuset %d, quota %.2f)\n", width, height, numFrames,
+        poolSize(pool), limits.online, limits.cpuset, limits.quota);
+    printf("%-24s %10s %10s %14s\n", "variant", "ms/frame", "relative",
+        "throttled ms");
+    
+    // Build the lens tables up front; their one-off cost is reported below.
+    double tableStart = benchNow();
+    const RayTable* table = rayTableGet(CAMERA_FISHEYE, 180.0, width, height);
+    double tableTime = benchNow() - tableStart;
+    
+    double base = 0.0;
+    for (int i = 0; i < numCases; i++) {
+        // Throttled time is per frame, like the frame time.
+        CpuThrottle before, after;
+        int throttleStats = cpuThrottleRead(&before);
+        double ms = timeFrames(pool, screen, width, height, numFrames,
+            &cases[i].config);
+        throttleStats = throttleStats && cpuThrottleRead(&after);
+        if (i == 0) base = ms;
+        printf("%-24s %10.3f %9.2fx", cases[i].name, ms, ms / base);
+        if (throttleStats)
+            printf(" %14.3f\n", (after.throttledTime - before.throttledTime)
+                * 1000.0 / numFrames);
+        else
+            printf(" %14s\n", "n/a");
+    }
+    
+    printf("ray table: built in %.3f ms, %zu bytes per lens\n",
+        tableTime * 1000.0, rayTableBytes(table));
+    benchDiff(pool, width, height, numFrames, &cases[0].config);
+    benchGeometry(pool, width, height, numFrames, &cases[0].config);
+    benchSharedGeometry(width, height, &cases[0].config);
+    benchCubeMap(width, height);
+    benchScanlines(pool, width, height, numFrames, &cases[0].config);
+    benchFrameStore(pool, width, height, numFrames, &cases[0].config);
+    benchColor(pool, width, height, numFrames, &cases[0].config);
+    benchShading(pool, width, height, numFrames, &cases[5].config);
+    benchEdit(pool, width, height, numFrames, &cases[0].config);
+    benchAccounting(pool, width, height, numFrames, &cases[0].config);
+    benchRenderQueue(pool, width, height, numFrames, &cases[0].config);
+    benchPlacement(width, height, numFrames, numThreads, &cases[0].config);
+    
+    cityLightsInit();
+    printf("city lights texture: %zu bytes sparse, %zu bytes as a bitmap\n",
+        cityLightsBytes(), (size_t) EARTH_DATA_SIZE * sizeof(uint64_t));
+    
+    free(screen);
+    poolDestroy(pool);
+}
@@ -0,0 +1,12 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Monotonic wall clock in seconds.
+double benchNow(void);
+
+// Time traceGlobe() for each renderer variant and print a table of
+// per-frame costs, and time lost to cgroup CPU throttling, to stdout.
+// numThreads < 1 sizes the pool from the CPU limits.
+void runBenchmark(int width, int height, int numFrames, int numThreads);
+
+#endif
@@ -0,0 +1,98 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "camera.h"
+#include "vec3.h"
+
+// Tables built so far, newest first.
+typedef struct RayTableNode {
+    RayTable table;
+    struct RayTableNode* next;
+} RayTableNode;
+
+static RayTableNode* tables;
+static pthread_mutex_t tablesLock = PTHREAD_MUTEX_INITIALIZER;
+
+double cameraDefaultFov(CameraModel model) {
+    switch (model) {
+    case CAMERA_FISHEYE: return 180.0;
+    case CAMERA_PANORAMIC: return 180.0;
+    default: return 60.0;
+    }
+}
+
+int cameraUsesRayTable(CameraModel model) {
+    return model == CAMERA_FISHEYE || model == CAMERA_PANORAMIC;
+}
+
+// Direction of the ray through pixel (x, y), or 0 if it has none.
+static Vec3 lensRay(CameraModel model, double fov, int width, int height,
+    int x, int y) {
+    
+    double halfFov = fov / 2.0 * DEG_TO_RAD;
+    // Pixel center relative to the image center, in units of half the
+    // image width, with y up.
+    double px = (x + 0.5) * 2.0 / width - 1.0;
+    double py = ((double) height - 2.0 * (y + 0.5)) / width;
+    
+    if (model == CAMERA_FISHEYE) {
+        // https://en.wikipedia.org/wiki/Fisheye_lens#Mapping_function
+        double rad = sqrt(px * px + py * py);
+        if (rad > 1.0)
+            return (Vec3) { 0.0, 0.0, 0.0 };
+        double theta = rad * halfFov;
+        double s = rad > 0.0 ? sin(theta) / rad : 0.0;
+        return (Vec3) { px * s, py * s, -cos(theta) };
+    }
+    
+    // https://en.wikipedia.org/wiki/Equirectangular_projection
+    double lon = px * halfFov;
+    double lat = py * halfFov;
+    if (fabs(lat) > PI_OVER_TWO)
+        return (Vec3) { 0.0, 0.0, 0.0 };
+    return (Vec3) { cos(lat) * sin(lon), sin(lat), -cos(lat) * cos(lon) };
+}
+
+static void buildRayTable(RayTable* table) {
+    size_t size = (size_t) table->width * table->height;
+    table->x = (float*) malloc(size * sizeof(float));
+    table->y = (float*) malloc(size * sizeof(float));
+    table->z = (float*) malloc(size * sizeof(float));
+    
+    size_t i = 0;
+    for (int y = 0; y < table->height; y++) {
+        for (int x = 0; x < table->width; x++) {
+            Vec3 u = lensRay(table->model, table->fov, table->width,
+                table->height, x, y);
+            table->x[i] = (float) u.x;
+            table->y[i] = (float) u.y;
+            table->z[i] = (float) u.z;
+            i++;
+        }
+    }
+}
+
+const RayTable* rayTableGet(CameraModel model, double fov,
+    int width, int height) {
+    
+    pthread_mutex_lock(&tablesLock);
+    RayTableNode* node = tables;
+    while (node && !(node->table.model == model && node->table.fov == fov &&
+        node->table.width == width && node->table.height == height))
+        node = node->next;
+    if (!node) {
+        node = (RayTableNode*) malloc(sizeof(RayTableNode));
+        node->table = (RayTable) { model, fov, width, height, 0, 0, 0 };
+        buildRayTable(&node->table);
+        node->next = tables;
+        tables = node;
+    }
+    pthread_mutex_unlock(&tablesLock);
+    
+    return &node->table;
+}
+
+size_t rayTableBytes(const RayTable* table) {
+    return (size_t) table->width * table->height * 3 * sizeof(float);
+}
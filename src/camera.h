@@ -0,0 +1,46 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stddef.h>
+
+// Lens models for traceGlobe(). All look down -z from the camera.
+typedef enum CameraModel {
+    // Perspective camera. Rays are built inline from the pixel position.
+    CAMERA_PINHOLE,
+    // Equidistant fisheye: the angle from the view axis grows linearly with
+    // the distance from the image center, with fov across the image circle.
+    // Pixels outside the circle are background.
+    CAMERA_FISHEYE,
+    // Equirectangular panorama: longitude and latitude grow linearly across
+    // and down the image, with fov across the width.
+    CAMERA_PANORAMIC,
+    // Parallel rays. Frames what the pinhole with the same fov would see in
+    // the plane through the globe's center.
+    CAMERA_ORTHOGRAPHIC
+} CameraModel;
+
+// Normalized ray direction of every pixel, one array per component (SoA),
+// for lenses whose rays need trig to build. Pixels without a ray are 0.
+typedef struct RayTable {
+    CameraModel model;
+    double fov;
+    int width, height;
+    float* x;
+    float* y;
+    float* z;
+} RayTable;
+
+// Field of view used when a config leaves it at 0.
+double cameraDefaultFov(CameraModel model);
+
+// 1 for lenses that read their rays from a RayTable.
+int cameraUsesRayTable(CameraModel model);
+
+// The table for a lens and resolution, built on first use and then shared.
+// Safe to call from several threads. Tables live until the program exits.
+const RayTable* rayTableGet(CameraModel model, double fov,
+    int width, int height);
+
+size_t rayTableBytes(const RayTable* table);
+
+#endif
@@ -0,0 +1,101 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "city_lights.h"
+#include "earth_data.h"
+
+// Lit texels x0 up to (not including) x1 of one row.
+typedef struct LightRun {
+    uint16_t x0, x1;
+} LightRun;
+
+// Runs of row y are runs[rowStart[y]] up to runs[rowStart[y + 1]].
+static uint32_t rowStart[EARTH_DATA_HEIGHT + 1];
+static LightRun* runs;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+// Integer hash for deterministic scattering of lights.
+// https://nullprogram.com/blog/2018/07/31/
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Land texel with ocean within two texels, where most cities are.
+static int coastal(int x, int y) {
+    for (int dy = -2; dy <= 2; dy++) {
+        int ty = y + dy;
+        if (ty < 0 || ty >= EARTH_DATA_HEIGHT) continue;
+        for (int dx = -2; dx <= 2; dx++) {
+            int tx = (x + dx + EARTH_DATA_WIDTH) % EARTH_DATA_WIDTH;
+            if (!sampleEarthData(tx, ty))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// There is no night imagery in the program, so lights are scattered over
+// land from the land mask: densely along coasts, thinly inland and not at
+// all toward the poles.
+static int lit(int x, int y) {
+    if (!sampleEarthData(x, y))
+        return 0;
+    // Rows within 30 degrees of either pole stay dark.
+    int polar = EARTH_DATA_HEIGHT / 6;
+    if (y < polar || y >= EARTH_DATA_HEIGHT - polar)
+        return 0;
+    uint32_t h = hash32(x + y * EARTH_DATA_WIDTH) % 100;
+    return h < (coastal(x, y) ? 30u : 5u);
+}
+
+static void buildCityLights(void) {
+    // Two passes: count runs, then fill them.
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t n = 0;
+        for (int y = 0; y < EARTH_DATA_HEIGHT; y++) {
+            rowStart[y] = n;
+            int x = 0;
+            while (x < EARTH_DATA_WIDTH) {
+                if (!lit(x, y)) {
+                    x++;
+                    continue;
+                }
+                int x0 = x;
+                while (x < EARTH_DATA_WIDTH && lit(x, y))
+                    x++;
+                if (pass == 1)
+                    runs[n] = (LightRun) { x0, x };
+                n++;
+            }
+        }
+        rowStart[EARTH_DATA_HEIGHT] = n;
+        if (pass == 0)
+            runs = (LightRun*) malloc((n ? n : 1) * sizeof(LightRun));
+    }
+}
+
+void cityLightsInit(void) {
+    pthread_once(&initOnce, buildCityLights);
+}
+
+int sampleCityLights(int x, int y) {
+    // Binary search for the last run starting at or before x.
+    uint32_t lo = rowStart[y];
+    uint32_t hi = rowStart[y + 1];
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (runs[mid].x0 <= x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > rowStart[y] && x < runs[lo - 1].x1;
+}
+
+size_t cityLightsBytes(void) {
+    return sizeof(rowStart) + rowStart[EARTH_DATA_HEIGHT] * sizeof(LightRun);
+}
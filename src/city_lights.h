@@ -0,0 +1,21 @@
+#ifndef CITY_LIGHTS_H
+#define CITY_LIGHTS_H
+
+#include <stddef.h>
+
+// Night-side city lights on the same 512x256 grid as earthData. Lit texels
+// are rare, so rows are stored as sorted runs of lit texels rather than as
+// a full bitmap.
+
+// Build the lights texture. Safe to call from several threads; only the
+// first call does any work.
+void cityLightsInit(void);
+
+// 1 if texel (x, y) is lit, else 0.
+int sampleCityLights(int x, int y);
+
+// Bytes used by the sparse texture, for comparison with the
+// EARTH_DATA_SIZE * 8 bytes of a full bitmap.
+size_t cityLightsBytes(void);
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "earth_data.h"
+#include "color_texture.h"
+
+// Largest texture loaded, in texels: 16384x8192, or 384 MB of RGB.
+#define PPM_MAX_TEXELS ((size_t) 1 << 27)
+
+// Next integer of a PPM header, skipping whitespace and comments. Returns
+// -1 at the end of the file or on anything else.
+static int ppmInt(FILE* file) {
+    int c = fgetc(file);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = fgetc(file);
+        c = fgetc(file);
+    }
+    if (c < '0' || c > '9')
+        return -1;
+    int value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        if (value > 1 << 20)
+            return -1;
+        c = fgetc(file);
+    }
+    // One whitespace byte ends the value (and the header).
+    return value;
+}
+
+ColorTexture* colorTextureLoadPpm(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    char magic[2];
+    int width = -1, height = -1, maxval = -1;
+    if (fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && magic[1] == '6') {
+        width = ppmInt(file);
+        height = ppmInt(file);
+        maxval = ppmInt(file);
+    }
+    // Each dimension is at most 1 << 20, so the product fits in a size_t.
+    if (width <= 0 || height <= 0 || maxval != 255 ||
+        (size_t) width * height > PPM_MAX_TEXELS) {
+        fclose(file);
+        return NULL;
+    }
+    
+    ColorTexture* texture = (ColorTexture*) malloc(sizeof(ColorTexture));
+    if (!texture) {
+        fclose(file);
+        return NULL;
+    }
+    texture->width = width;
+    texture->height = height;
+    size_t size = (size_t) width * height * 3;
+    texture->rgb = (uint8_t*) malloc(size);
+    if (!texture->rgb || fread(texture->rgb, 1, size, file) != size) {
+        colorTextureFree(texture);
+        texture = NULL;
+    }
+    fclose(file);
+    return texture;
+}
+
+// Integer hash for deterministic noise.
+// https://nullprogram.com/blog/2018/07/31/
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Texels to the nearest texel of the other kind (land or ocean), up to
+// limit.
+static int coastDistance(int x, int y, int limit) {
+    int land = sampleEarthData(x, y);
+    for (int d = 1; d < limit; d++) {
+        for (int dy = -d; dy <= d; dy++) {
+            int ty = y + dy;
+            if (ty < 0 || ty >= EARTH_DATA_HEIGHT) continue;
+            for (int dx = -d; dx <= d; dx++) {
+                int tx = (x + dx + EARTH_DATA_WIDTH) % EARTH_DATA_WIDTH;
+                if (sampleEarthData(tx, ty) != land)
+                    return d;
+            }
+        }
+    }
+    return limit;
+}
+
+static void mix(uint8_t* out, const uint8_t* a, const uint8_t* b,
+    double t) {
+    
+    if (t < 0.0) t = 0.0;
+    else if (t > 1.0) t = 1.0;
+    for (int c = 0; c < 3; c++)
+        out[c] = (uint8_t) (a[c] + (b[c] - a[c]) * t + 0.5);
+}
+
+ColorTexture* colorTextureProcedural(void) {
+    static const uint8_t forest[3] = { 46, 94, 38 };
+    static const uint8_t grass[3] = { 110, 140, 62 };
+    static const uint8_t desert[3] = { 200, 172, 118 };
+    static const uint8_t ice[3] = { 236, 240, 244 };
+    static const uint8_t deep[3] = { 8, 32, 96 };
+    static const uint8_t shallow[3] = { 32, 98, 160 };
+    
+    ColorTexture* texture = (ColorTexture*) malloc(sizeof(ColorTexture));
+    texture->width = EARTH_DATA_WIDTH;
+    texture->height = EARTH_DATA_HEIGHT;
+    texture->rgb = (uint8_t*) malloc(EARTH_DATA_WIDTH * EARTH_DATA_HEIGHT *
+        3);
+    for (int y = 0; y < EARTH_DATA_HEIGHT; y++) {
+        // Degrees from the equator.
+        double lat = fabs(90.0 - (y + 0.5) * 180.0 / EARTH_DATA_HEIGHT);
+        for (int x = 0; x < EARTH_DATA_WIDTH; x++) {
+            uint8_t* out = texture->rgb + (y * EARTH_DATA_WIDTH + x) * 3;
+            double noise = (hash32(x + y * EARTH_DATA_WIDTH) & 255) / 255.0;
+            int coast = coastDistance(x, y, 6);
+            if (sampleEarthData(x, y)) {
+                // Dry around 25 degrees, more so away from the coast.
+                double dry = (1.0 - fabs(lat - 25.0) / 12.0) +
+                    0.1 * coast - 0.3;
+                uint8_t green[3];
+                mix(green, forest, grass, noise * 0.6 + lat / 90.0);
+                mix(out, green, desert, dry + 0.3 * noise);
+                mix(out, out, ice, (lat - 62.0) / 8.0);
+            } else {
+                mix(out, shallow, deep, coast / 5.0);
+                mix(out, out, ice, (lat - 72.0) / 6.0);
+            }
+        }
+    }
+    return texture;
+}
+
+void colorTextureFree(ColorTexture* texture) {
+    free(texture->rgb);
+    free(texture);
+}
+
+void colorPaletteBuild(uint8_t* palette, const uint8_t* base, int numBase) {
+    memcpy(palette, base, numBase * 3);
+    uint8_t* out = palette + numBase * 3;
+    for (int r = 0; r < 6; r++) {
+        for (int g = 0; g < 6; g++) {
+            for (int b = 0; b < 6; b++) {
+                *out++ = r * 51;
+                *out++ = g * 51;
+                *out++ = b * 51;
+            }
+        }
+    }
+    // Grays between the cube's, for ice and cloud.
+    int numGrays = COLOR_PALETTE_SIZE - numBase - 216;
+    for (int k = 0; k < numGrays; k++) {
+        int v = 255 * (k + 1) / (numGrays + 1);
+        *out++ = v;
+        *out++ = v;
+        *out++ = v;
+    }
+}
+
+uint8_t colorNearest(const uint8_t* palette, int first, int numColors,
+    int r, int g, int b) {
+    
+    int best = first, bestDistance = 1 << 30;
+    for (int k = first; k < first + numColors; k++) {
+        const uint8_t* p = palette + k * 3;
+        // Weighted roughly by the eye's sensitivity to each channel.
+        int dr = r - p[0], dg = g - p[1], db = b - p[2];
+        int distance = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = k;
+        }
+    }
+    return (uint8_t) best;
+}
+
+void colorLutBuild(ColorLut* lut, const uint8_t* palette, int first,
+    int numColors) {
+    
+    lut->palette = palette;
+    int cells = 1 << COLOR_LUT_BITS;
+    int shift = 8 - COLOR_LUT_BITS;
+    // Each cell takes the color nearest its center.
+    int half = 1 << (shift - 1);
+    for (int r = 0; r < cells; r++)
+        for (int g = 0; g < cells; g++)
+            for (int b = 0; b < cells; b++)
+                lut->index[(r * cells + g) * cells + b] = colorNearest(
+                    palette, first, numColors, r << shift | half,
+                    g << shift | half, b << shift | half);
+}
@@ -0,0 +1,56 @@
+#ifndef COLOR_TEXTURE_H
+#define COLOR_TEXTURE_H
+
+#include <stdint.h>
+
+// Full-color equirectangular texture, sampled in the same frame as
+// earthData (texCoordX() and texCoordY() scaled to its size).
+typedef struct ColorTexture {
+    int width, height;
+    // width * height RGB triples, row by row from the north pole.
+    uint8_t* rgb;
+} ColorTexture;
+
+// Load a binary PPM (P6, maxval 255) of up to 1 << 27 texels (16384x8192).
+// Returns NULL if it cannot be read or is larger.
+ColorTexture* colorTextureLoadPpm(const char* path);
+// Earth colors made up from the land mask (there is no imagery in the
+// program): ice toward the poles, deserts around the tropics, forest
+// elsewhere, and ocean that is lighter along the coasts.
+ColorTexture* colorTextureProcedural(void);
+void colorTextureFree(ColorTexture* texture);
+
+// Palette for color output: numBase entries of base (globePalette, so the
+// background, rings and city lights keep their indices), then a 6x6x6
+// color cube and a gray ramp for the texture, COLOR_PALETTE_SIZE in all.
+#define COLOR_PALETTE_SIZE 256
+void colorPaletteBuild(uint8_t* palette, const uint8_t* base, int numBase);
+
+// 32x32x32 table from RGB (5 bits a channel) to the nearest of palette
+// entries first up to first + numColors, so quantizing a pixel is one
+// load instead of a search of the palette.
+#define COLOR_LUT_BITS 5
+typedef struct ColorLut {
+    const uint8_t* palette;
+    uint8_t index[1 << (3 * COLOR_LUT_BITS)];
+} ColorLut;
+
+// Build the table for palette, which must outlive it. Takes a few
+// milliseconds; build it once per palette.
+void colorLutBuild(ColorLut* lut, const uint8_t* palette, int first,
+    int numColors);
+
+static inline uint8_t colorLutIndex(const ColorLut* lut, int r, int g,
+    int b) {
+    
+    int shift = 8 - COLOR_LUT_BITS;
+    return lut->index[(r >> shift) << (2 * COLOR_LUT_BITS) |
+        (g >> shift) << COLOR_LUT_BITS | (b >> shift)];
+}
+
+// Nearest of the palette entries by exhaustive search, which the table
+// replaces.
+uint8_t colorNearest(const uint8_t* palette, int first, int numColors,
+    int r, int g, int b);
+
+#endif
@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu_limits.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+// Read a small file into buf (always terminated). Returns 0 on failure.
+static int readFile(const char* path, char* buf, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return 0;
+    size_t n = fread(buf, 1, size - 1, file);
+    buf[n] = '\0';
+    fclose(file);
+    return n > 0;
+}
+
+// Find our cgroup's directory for the given controller ("" for the cgroup
+// v2 unified hierarchy) from /proc/self/cgroup. Inside a container with its
+// own cgroup namespace the path is "/", so the mount root is the cgroup.
+static int cgroupDir(const char* v1Mount, char* dir, size_t size) {
+    char buf[4096];
+    if (!readFile("/proc/self/cgroup", buf, sizeof(buf)))
+        return 0;
+    
+    // Lines are "hierarchy-ID:controller-list:path".
+    char* save;
+    for (char* line = strtok_r(buf, "\n", &save); line;
+        line = strtok_r(NULL, "\n", &save)) {
+        char* controllers = strchr(line, ':');
+        if (!controllers) continue;
+        char* path = strchr(++controllers, ':');
+        if (!path) continue;
+        *path++ = '\0';
+        
+        int match;
+        if (!v1Mount) {
+            match = controllers[0] == '\0';
+        } else {
+            // Controller list is comma separated, e.g. "cpu,cpuacct".
+            match = 0;
+            for (char* c = controllers; c; c = strchr(c, ',')) {
+                if (*c == ',') c++;
+                if (strncmp(c, "cpu", 3) == 0 && (c[3] == ',' || !c[3]))
+                    match = 1;
+            }
+        }
+        if (!match) continue;
+        
+        const char* mount = v1Mount ? v1Mount : CGROUP_ROOT;
+        snprintf(dir, size, "%s%s", mount, path);
+        if (access(dir, F_OK) != 0)
+            snprintf(dir, size, "%s", mount);
+        return 1;
+    }
+    return 0;
+}
+
+// Strip the last path component. Returns 0 once dir is at or above root.
+static int parentDir(char* dir, const char* root) {
+    size_t rootLen = strlen(root);
+    char* slash = strrchr(dir, '/');
+    if (!slash || (size_t) (slash - dir) < rootLen)
+        return 0;
+    *slash = '\0';
+    return 1;
+}
+
+// Smallest CFS quota (in CPUs) on the way from dir up to root, since any
+// ancestor's quota also applies to us. 0 if unlimited.
+static double quotaCpus(char* dir, const char* root, int v2) {
+    double quota = 0.0;
+    do {
+        char path[4096 + 32];
+        char buf[128];
+        double q = -1.0, period = 0.0;
+        if (v2) {
+            // cpu.max is "$MAX $PERIOD", where $MAX may be "max".
+            snprintf(path, sizeof(path), "%s/cpu.max", dir);
+            if (readFile(path, buf, sizeof(buf)) && strncmp(buf, "max", 3))
+                sscanf(buf, "%lf %lf", &q, &period);
+        } else {
+            // cpu.cfs_quota_us is -1 when unlimited.
+            snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+            if (readFile(path, buf, sizeof(buf)))
+                q = atof(buf);
+            snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+            if (readFile(path, buf, sizeof(buf)))
+                period = atof(buf);
+        }
+        if (q > 0.0 && period > 0.0 && (quota == 0.0 || q / period < quota))
+            quota = q / period;
+    } while (parentDir(dir, root));
+    return quota;
+}
+
+void cpuLimitsRead(CpuLimits* limits) {
+    limits->online = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (limits->online < 1) limits->online = 1;
+    
+    cpu_set_t set;
+    limits->cpuset = limits->online;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        limits->cpuset = CPU_COUNT(&set);
+    
+    char dir[4096];
+    limits->quota = 0.0;
+    if (cgroupDir(NULL, dir, sizeof(dir)))
+        limits->quota = quotaCpus(dir, CGROUP_ROOT, 1);
+    if (limits->quota == 0.0 && cgroupDir(CGROUP_ROOT "/cpu", dir, sizeof(dir)))
+        limits->quota = quotaCpus(dir, CGROUP_ROOT "/cpu", 0);
+    
+    // Round the quota down: a pool that needs 2 CPUs under a 1.5 CPU quota
+    // is throttled every period.
+    limits->threads = limits->cpuset < limits->online ?
+        limits->cpuset : limits->online;
+    if (limits->quota > 0.0 && (int) limits->quota < limits->threads)
+        limits->threads = (int) limits->quota;
+    if (limits->threads < 1) limits->threads = 1;
+}
+
+int cpuThrottleRead(CpuThrottle* throttle) {
+    char dir[4096];
+    char path[4096 + 32];
+    char buf[1024];
+    // cgroup v2 reports throttled_usec, v1 reports throttled_time in ns.
+    int v2 = cgroupDir(NULL, dir, sizeof(dir));
+    if (v2) {
+        snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+        v2 = readFile(path, buf, sizeof(buf)) && strstr(buf, "nr_throttled");
+    }
+    if (!v2) {
+        if (!cgroupDir(CGROUP_ROOT "/cpu", dir, sizeof(dir)))
+            return 0;
+        snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+        if (!readFile(path, buf, sizeof(buf)))
+            return 0;
+    }
+    
+    *throttle = (CpuThrottle) { 0, 0, 0.0 };
+    int found = 0;
+    char* save;
+    for (char* line = strtok_r(buf, "\n", &save); line;
+        line = strtok_r(NULL, "\n", &save)) {
+        char key[64];
+        long long value;
+        if (sscanf(line, "%63s %lld", key, &value) != 2)
+            continue;
+        if (strcmp(key, "nr_periods") == 0) {
+            throttle->periods = value;
+        } else if (strcmp(key, "nr_throttled") == 0) {
+            throttle->throttledPeriods = value;
+            found = 1;
+        } else if (strcmp(key, "throttled_usec") == 0) {
+            throttle->throttledTime = value * 1e-6;
+        } else if (strcmp(key, "throttled_time") == 0) {
+            throttle->throttledTime = value * 1e-9;
+        }
+    }
+    return found;
+}
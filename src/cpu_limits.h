@@ -0,0 +1,34 @@
+#ifndef CPU_LIMITS_H
+#define CPU_LIMITS_H
+
+// How many CPUs this process may actually use. Containers usually see every
+// host CPU in nproc while a cgroup quota or cpuset allows far fewer, and a
+// pool sized by nproc then gets throttled.
+typedef struct CpuLimits {
+    // CPUs online on the host.
+    int online;
+    // CPUs in our affinity mask, which the kernel keeps inside the cgroup's
+    // cpuset.
+    int cpuset;
+    // CPUs worth of time allowed by the CFS quota (cgroup v2 cpu.max or v1
+    // cpu.cfs_quota_us / cpu.cfs_period_us), or 0 if unlimited.
+    double quota;
+    // Recommended pool size: the smallest of the above, at least 1.
+    int threads;
+} CpuLimits;
+
+void cpuLimitsRead(CpuLimits* limits);
+
+// Throttling counters from the cgroup's cpu.stat. They only ever grow, so
+// take the difference of two reads to cover an interval.
+typedef struct CpuThrottle {
+    long long periods;
+    long long throttledPeriods;
+    // Seconds the cgroup spent throttled.
+    double throttledTime;
+} CpuThrottle;
+
+// Returns 0 if no cpu.stat with throttling counters could be found.
+int cpuThrottleRead(CpuThrottle* throttle);
+
+#endif
@@ -0,0 +1,54 @@
+#include <math.h>
+#include <pthread.h>
+
+#include "earth_data.h"
+#include "city_lights.h"
+#include "globe.h"
+#include "cube_map.h"
+
+uint64_t cubeMapLand[CUBE_MAP_WORDS];
+uint64_t cubeMapLights[CUBE_MAP_WORDS];
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+// Nearest-texel reprojection: each cube texel takes the equirectangular
+// texel under its center. Near the poles many equirectangular texels fall
+// in one cube texel and all but one are dropped, which is the
+// oversampling the cube map is there to avoid.
+static void buildCubeMap(void) {
+    cityLightsInit();
+    for (int face = 0; face < 6; face++) {
+        double sign = face & 1 ? -1.0 : 1.0;
+        for (int j = 0; j < CUBE_MAP_FACE; j++) {
+            for (int i = 0; i < CUBE_MAP_FACE; i++) {
+                // Inverse of cubeMapTexel().
+                double u = (i + 0.5) * 2.0 / CUBE_MAP_FACE - 1.0;
+                double v = (j + 0.5) * 2.0 / CUBE_MAP_FACE - 1.0;
+                Vec3 n;
+                if (face < 2)
+                    n = (Vec3) { sign, u, v };
+                else if (face < 4)
+                    n = (Vec3) { v, sign, u };
+                else
+                    n = (Vec3) { u, v, sign };
+                n = vscl(n, 1.0 / sqrt(vmag2(n)));
+                
+                int texX = texCoordX(n, EARTH_DATA_WIDTH);
+                int texY = texCoordY(n, EARTH_DATA_HEIGHT);
+                int texel = cubeMapTexel(n);
+                uint64_t bit = (uint64_t) 1 << (texel & 63);
+                if (sampleEarthData(texX, texY))
+                    cubeMapLand[texel >> 6] |= bit;
+                if (sampleCityLights(texX, texY))
+                    cubeMapLights[texel >> 6] |= bit;
+            }
+        }
+    }
+}
+
+void cubeMapInit(void) {
+    pthread_once(&initOnce, buildCubeMap);
+}
+
+size_t cubeMapBytes(void) {
+    return sizeof(cubeMapLand);
+}
@@ -0,0 +1,73 @@
+#ifndef CUBE_MAP_H
+#define CUBE_MAP_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec3.h"
+#include "earth_data.h"
+
+// earthData and the city lights reprojected onto the six faces of a cube.
+// The equirectangular grid spends as many texels on a row near a pole as
+// on the equator; a cube map's texels cover roughly equal areas, so at the
+// same resolution around the equator (four faces of CUBE_MAP_FACE texels
+// for EARTH_DATA_WIDTH) it needs 6 * 128^2 bits instead of 512 * 256.
+// Looking a texel up takes a division instead of atan2() and asin().
+
+#define CUBE_MAP_FACE (EARTH_DATA_WIDTH / 4)
+// Texels are stored in 8x8 blocks of one uint64_t each, so neighboring
+// pixels usually read the same word whichever way the face runs on screen.
+#define CUBE_MAP_BLOCKS (CUBE_MAP_FACE / 8)
+#define CUBE_MAP_WORDS (6 * CUBE_MAP_BLOCKS * CUBE_MAP_BLOCKS)
+
+extern uint64_t cubeMapLand[CUBE_MAP_WORDS];
+extern uint64_t cubeMapLights[CUBE_MAP_WORDS];
+
+// Build both maps from earthData and the city lights. Safe to call from
+// several threads; only the first call does any work.
+void cubeMapInit(void);
+
+// Index of the texel under unit direction n, in the texture frame of
+// texCoordX() and texCoordY(): the face is picked by n's largest component
+// and the position on it is the other two divided by that one. The word
+// is index >> 6 and the bit index & 63.
+static inline int cubeMapTexel(Vec3 n) {
+    double ax = fabs(n.x), ay = fabs(n.y), az = fabs(n.z);
+    double major, u, v;
+    int face;
+    if (ax >= ay && ax >= az) {
+        face = n.x < 0.0;
+        major = ax;
+        u = n.y;
+        v = n.z;
+    } else if (ay >= az) {
+        face = 2 + (n.y < 0.0);
+        major = ay;
+        u = n.z;
+        v = n.x;
+    } else {
+        face = 4 + (n.z < 0.0);
+        major = az;
+        u = n.x;
+        v = n.y;
+    }
+    double scale = 0.5 * CUBE_MAP_FACE / major;
+    int i = (int) ((u + major) * scale);
+    int j = (int) ((v + major) * scale);
+    if (i >= CUBE_MAP_FACE) i = CUBE_MAP_FACE - 1;
+    if (j >= CUBE_MAP_FACE) j = CUBE_MAP_FACE - 1;
+    int block = (face * CUBE_MAP_BLOCKS + (j >> 3)) * CUBE_MAP_BLOCKS +
+        (i >> 3);
+    return block << 6 | (j & 7) << 3 | (i & 7);
+}
+
+static inline int cubeMapSample(const uint64_t* map, int texel) {
+    return (map[texel >> 6] >> (texel & 63)) & 1;
+}
+
+// Bytes used by one map, for comparison with the EARTH_DATA_SIZE * 8 bytes
+// of earthData.
+size_t cubeMapBytes(void);
+
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fanout.h"
+
+// Bytes shared by every sink that queued them. Freed by the last one.
+typedef struct FanoutChunk {
+    int refs;
+    size_t size;
+    uint8_t data[];
+} FanoutChunk;
+
+typedef struct FanoutNode {
+    FanoutChunk* chunk;
+    struct FanoutNode* next;
+} FanoutNode;
+
+typedef struct FanoutSink {
+    struct Fanout* fanout;
+    FanoutWriteFn* fn;
+    void* context;
+    FanoutPolicy policy;
+    size_t maxQueued;
+    // Chunks waiting to be written, oldest first.
+    FanoutNode* head;
+    FanoutNode* tail;
+    size_t queued;
+    // Signalled when a chunk is queued or the fanout is closing.
+    pthread_cond_t ready;
+    pthread_t thread;
+    FanoutSinkStats stats;
+} FanoutSink;
+
+struct Fanout {
+    pthread_mutex_t lock;
+    // Signalled when a sink has written a chunk.
+    pthread_cond_t space;
+    size_t chunkSize;
+    // Chunk being filled by fanoutWrite().
+    FanoutChunk* chunk;
+    FanoutSink sinks[FANOUT_MAX_SINKS];
+    int numSinks;
+    int closing;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double threadCpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static FanoutChunk* chunkCreate(size_t size) {
+    FanoutChunk* chunk = (FanoutChunk*) malloc(sizeof(FanoutChunk) + size);
+    chunk->refs = 1;
+    chunk->size = 0;
+    return chunk;
+}
+
+// Drop a reference. Called with the lock held.
+static void chunkRelease(FanoutChunk* chunk) {
+    if (--chunk->refs == 0)
+        free(chunk);
+}
+
+static void* sinkThread(void* arg) {
+    FanoutSink* sink = (FanoutSink*) arg;
+    Fanout* fanout = sink->fanout;
+    
+    pthread_mutex_lock(&fanout->lock);
+    for (;;) {
+        while (!sink->head && !fanout->closing)
+            pthread_cond_wait(&sink->ready, &fanout->lock);
+        if (!sink->head)
+            break;
+        
+        FanoutNode* node = sink->head;
+        sink->head = node->next;
+        if (!sink->head) sink->tail = NULL;
+        FanoutChunk* chunk = node->chunk;
+        free(node);
+        
+        // A failed sink still drains its queue so the chunks are released.
+        if (!sink->stats.failed) {
+            pthread_mutex_unlock(&fanout->lock);
+            double start = now(), startCpu = threadCpu();
+            int result = sink->fn(sink->context, chunk->data, chunk->size);
+            double elapsed = now() - start, cpu = threadCpu() - startCpu;
+            pthread_mutex_lock(&fanout->lock);
+            sink->stats.busy += elapsed;
+            sink->stats.cpu += cpu;
+            if (result == 0) {
+                sink->stats.bytes += chunk->size;
+            } else {
+                sink->stats.failed = 1;
+                sink->stats.detached = 1;
+            }
+        }
+        sink->queued -= chunk->size;
+        chunkRelease(chunk);
+        pthread_cond_broadcast(&fanout->space);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    
+    return NULL;
+}
+
+Fanout* fanoutCreate(size_t chunkSize) {
+    if (chunkSize < 1) chunkSize = 1;
+    Fanout* fanout = (Fanout*) calloc(1, sizeof(Fanout));
+    pthread_mutex_init(&fanout->lock, NULL);
+    pthread_cond_init(&fanout->space, NULL);
+    fanout->chunkSize = chunkSize;
+    fanout->chunk = chunkCreate(chunkSize);
+    return fanout;
+}
+
+int fanoutAddSink(Fanout* fanout, const char* name, FanoutWriteFn* fn,
+    void* context, FanoutPolicy policy, size_t maxQueued) {
+    
+    if (fanout->numSinks == FANOUT_MAX_SINKS)
+        return 0;
+    FanoutSink* sink = &fanout->sinks[fanout->numSinks];
+    *sink = (FanoutSink) {
+        .fanout = fanout,
+        .fn = fn,
+        .context = context,
+        .policy = policy,
+        .maxQueued = maxQueued
+    };
+    sink->stats.name = name;
+    pthread_cond_init(&sink->ready, NULL);
+    if (pthread_create(&sink->thread, NULL, sinkThread, sink) != 0) {
+        pthread_cond_destroy(&sink->ready);
+        return 0;
+    }
+    fanout->numSinks++;
+    return 1;
+}
+
+// Queue the current chunk on every sink that takes it. Called with the
+// lock held. Returns the number of sinks still attached.
+static int publish(Fanout* fanout) {
+    FanoutChunk* chunk = fanout->chunk;
+    int attached = 0;
+    for (int i = 0; i < fanout->numSinks; i++) {
+        FanoutSink* sink = &fanout->sinks[i];
+        if (sink->stats.detached)
+            continue;
+        
+        // A sink with nothing queued always takes the chunk, so chunks
+        // larger than maxQueued still get through.
+        int full = sink->queued > 0 &&
+            sink->queued + chunk->size > sink->maxQueued;
+        if (full && sink->policy == FANOUT_BLOCK) {
+            while (sink->queued > 0 && !sink->stats.detached &&
+                sink->queued + chunk->size > sink->maxQueued)
+                pthread_cond_wait(&fanout->space, &fanout->lock);
+            if (sink->stats.detached)
+                continue;
+        } else if (full && sink->policy == FANOUT_DROP) {
+            sink->stats.droppedBytes += chunk->size;
+            attached++;
+            continue;
+        } else if (full) {
+            sink->stats.detached = 1;
+            continue;
+        }
+        
+        FanoutNode* node = (FanoutNode*) malloc(sizeof(FanoutNode));
+        *node = (FanoutNode) { chunk, NULL };
+        chunk->refs++;
+        if (sink->tail) sink->tail->next = node;
+        else sink->head = node;
+        sink->tail = node;
+        sink->queued += chunk->size;
+        if (sink->queued > sink->stats.maxQueued)
+            sink->stats.maxQueued = sink->queued;
+        pthread_cond_signal(&sink->ready);
+        attached++;
+    }
+    chunkRelease(chunk);
+    fanout->chunk = chunkCreate(fanout->chunkSize);
+    return attached;
+}
+
+int fanoutWrite(void* context, const uint8_t* data, const size_t numBytes) {
+    Fanout* fanout = (Fanout*) context;
+    int attached = 1;
+    size_t done = 0;
+    
+    pthread_mutex_lock(&fanout->lock);
+    while (done < numBytes) {
+        FanoutChunk* chunk = fanout->chunk;
+        size_t n = fanout->chunkSize - chunk->size;
+        if (n > numBytes - done) n = numBytes - done;
+        memcpy(chunk->data + chunk->size, data + done, n);
+        chunk->size += n;
+        done += n;
+        if (chunk->size == fanout->chunkSize)
+            attached = publish(fanout);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    
+    return attached > 0 ? 0 : -1;
+}
+
+void fanoutFlush(Fanout* fanout) {
+    pthread_mutex_lock(&fanout->lock);
+    if (fanout->chunk->size > 0)
+        publish(fanout);
+    pthread_mutex_unlock(&fanout->lock);
+}
+
+int fanoutClose(Fanout* fanout, FanoutSinkStats* stats) {
+    pthread_mutex_lock(&fanout->lock);
+    if (fanout->chunk->size > 0)
+        publish(fanout);
+    fanout->closing = 1;
+    for (int i = 0; i < fanout->numSinks; i++)
+        pthread_cond_signal(&fanout->sinks[i].ready);
+    pthread_mutex_unlock(&fanout->lock);
+    
+    int status = 0;
+    for (int i = 0; i < fanout->numSinks; i++) {
+        FanoutSink* sink = &fanout->sinks[i];
+        pthread_join(sink->thread, NULL);
+        pthread_cond_destroy(&sink->ready);
+        if (sink->stats.failed && sink->policy == FANOUT_BLOCK)
+            status = -1;
+        if (stats)
+            stats[i] = sink->stats;
+    }
+    
+    free(fanout->chunk);
+    pthread_cond_destroy(&fanout->space);
+    pthread_mutex_destroy(&fanout->lock);
+    free(fanout);
+    return status;
+}
+
+int fanoutFdWrite(void* context, const uint8_t* data, const size_t numBytes) {
+    int fd = (int) (intptr_t) context;
+    size_t done = 0;
+    while (done < numBytes) {
+        // send() keeps a closed socket from raising SIGPIPE.
+        ssize_t n = send(fd, data + done, numBytes - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = write(fd, data + done, numBytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int fanoutConnect(const char* hostPort) {
+    char host[256];
+    const char* colon = strrchr(hostPort, ':');
+    if (!colon || (size_t) (colon - hostPort) >= sizeof(host))
+        return -1;
+    memcpy(host, hostPort, colon - hostPort);
+    host[colon - hostPort] = '\0';
+    
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+    struct addrinfo* addrs;
+    if (getaddrinfo(host, colon + 1, &hints, &addrs) != 0)
+        return -1;
+    int fd = -1;
+    for (struct addrinfo* a = addrs; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+int fanoutMemoryWrite(void* context, const uint8_t* data,
+    const size_t numBytes) {
+    
+    FanoutMemory* memory = (FanoutMemory*) context;
+    if (memory->size + numBytes > memory->capacity) {
+        size_t capacity = memory->capacity ? memory->capacity : 1 << 16;
+        while (capacity < memory->size + numBytes)
+            capacity *= 2;
+        uint8_t* grown = (uint8_t*) realloc(memory->data, capacity);
+        if (!grown)
+            return -1;
+        memory->data = grown;
+        memory->capacity = capacity;
+    }
+    memcpy(memory->data + memory->size, data, numBytes);
+    memory->size += numBytes;
+    return 0;
+}
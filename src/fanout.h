@@ -0,0 +1,86 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes one encoded stream to several sinks at once (a file, a socket, a
+// memory cache, ...) without encoding it more than once. Bytes from the
+// encoder are copied once into reference counted chunks, and every sink's
+// thread writes the same chunks from its own queue.
+typedef struct Fanout Fanout;
+
+// Sink output, with the same shape as cgif_write_fn. Returns 0 on success.
+typedef int FanoutWriteFn(void* context, const uint8_t* data,
+    const size_t numBytes);
+
+// What to do when a sink has fallen maxQueued bytes behind.
+typedef enum FanoutPolicy {
+    // Wait for the sink, slowing down the encoder and every other sink.
+    FANOUT_BLOCK,
+    // Skip chunks until the sink catches up. The sink's copy has gaps, so
+    // this only suits consumers that resynchronize, e.g. live previews.
+    FANOUT_DROP,
+    // Stop writing to the sink for good.
+    FANOUT_DETACH
+} FanoutPolicy;
+
+typedef struct FanoutSinkStats {
+    const char* name;
+    size_t bytes;
+    size_t droppedBytes;
+    // Most bytes that were ever waiting in the sink's queue.
+    size_t maxQueued;
+    // Seconds spent in the sink's write function, and CPU seconds its
+    // thread used there.
+    double busy;
+    double cpu;
+    int detached;
+    // The write function returned an error, which also detaches the sink.
+    int failed;
+} FanoutSinkStats;
+
+// Most sinks one fanout takes; fanoutAddSink() refuses more.
+#define FANOUT_MAX_SINKS 16
+
+// chunkSize is how many bytes are gathered before they are handed out.
+Fanout* fanoutCreate(size_t chunkSize);
+
+// Add a sink before the first write. Returns 0 if its thread could not be
+// started.
+int fanoutAddSink(Fanout* fanout, const char* name, FanoutWriteFn* fn,
+    void* context, FanoutPolicy policy, size_t maxQueued);
+
+// Append bytes. Matches cgif_write_fn, so a fanout can be passed as
+// CGIF_Config.pContext with this as pWriteFn. Returns -1 once every sink
+// has failed or detached.
+int fanoutWrite(void* context, const uint8_t* data, const size_t numBytes);
+
+// Hand out the bytes gathered so far without waiting for a full chunk,
+// e.g. at the end of each frame for sinks that stream live.
+void fanoutFlush(Fanout* fanout);
+
+// Hand out the last chunk, wait for the sinks to write everything queued,
+// and free the fanout. stats, if not NULL, gets an entry per sink in the
+// order they were added. Returns -1 if a FANOUT_BLOCK sink failed.
+int fanoutClose(Fanout* fanout, FanoutSinkStats* stats);
+
+// Write function for a file descriptor (context is the fd cast with
+// (void*) (intptr_t)). Works for files, pipes and sockets.
+int fanoutFdWrite(void* context, const uint8_t* data, const size_t numBytes);
+
+// Connect a TCP socket to "host:port". Returns the fd or -1.
+int fanoutConnect(const char* hostPort);
+
+// Growable in-memory copy of the stream.
+typedef struct FanoutMemory {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} FanoutMemory;
+
+// Write function appending to a FanoutMemory.
+int fanoutMemoryWrite(void* context, const uint8_t* data,
+    const size_t numBytes);
+
+#endif
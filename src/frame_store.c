@@ -0,0 +1,295 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_store.h"
+
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+
+typedef struct StoredFrame {
+    uint8_t* data;
+    size_t size;
+    // Neighbors in the recently viewed list, -1 at either end.
+    int newer, older;
+} StoredFrame;
+
+struct FrameStore {
+    int width, height;
+    size_t budget;
+    pthread_mutex_t lock;
+    // Indexed by frame number, data == NULL for frames not stored.
+    StoredFrame* frames;
+    int numSlots;
+    // Most and least recently viewed frames, -1 if none.
+    int newest, oldest;
+    FrameStoreStats stats;
+    // Compression scratch, FRAME_COMPRESS_BOUND of a frame.
+    uint8_t* scratch;
+};
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Length in LZ4's style: 15 in the nibble means more follows, in bytes of
+// 255 ended by one below 255.
+static uint8_t* writeLength(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t) length;
+    return out;
+}
+
+static uint8_t* writeSequence(uint8_t* out, const uint8_t* literals,
+    size_t numLiterals, size_t offset, size_t matchLength) {
+    
+    size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+    *out++ = (uint8_t) ((numLiterals < 15 ? numLiterals : 15) << 4 |
+        (matchCode < 15 ? matchCode : 15));
+    if (numLiterals >= 15)
+        out = writeLength(out, numLiterals - 15);
+    memcpy(out, literals, numLiterals);
+    out += numLiterals;
+    if (matchLength) {
+        *out++ = (uint8_t) offset;
+        *out++ = (uint8_t) (offset >> 8);
+        if (matchCode >= 15)
+            out = writeLength(out, matchCode - 15);
+    }
+    return out;
+}
+
+size_t frameCompress(const uint8_t* src, size_t size, uint8_t* dst,
+    size_t capacity) {
+    
+    // Compress into dst directly when the worst case fits.
+    uint8_t* out = capacity >= FRAME_COMPRESS_BOUND(size) ? dst :
+        (uint8_t*) malloc(FRAME_COMPRESS_BOUND(size));
+    uint8_t* start = out;
+    // Position + 1 of the last place each hashed 4 bytes were seen.
+    uint32_t table[1 << HASH_BITS] = { 0 };
+    size_t ip = 0, anchor = 0;
+    while (ip + MIN_MATCH <= size) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        size_t ref = table[h];
+        table[h] = (uint32_t) ip + 1;
+        if (ref == 0 || ip - (ref - 1) > MAX_OFFSET ||
+            read32(src + ref - 1) != seq) {
+            ip++;
+            continue;
+        }
+        ref--;
+        size_t length = MIN_MATCH;
+        while (ip + length < size && src[ref + length] == src[ip + length])
+            length++;
+        out = writeSequence(out, src + anchor, ip - anchor, ip - ref,
+            length);
+        ip += length;
+        anchor = ip;
+    }
+    out = writeSequence(out, src + anchor, size - anchor, 0, 0);
+    
+    size_t compressed = out - start;
+    if (start != dst) {
+        if (compressed <= capacity)
+            memcpy(dst, start, compressed);
+        else
+            compressed = 0;
+        free(start);
+    }
+    return compressed;
+}
+
+// Read an extended length, or return 0 (and leave *length) at the end of
+// the input.
+static int readLength(const uint8_t** in, const uint8_t* end,
+    size_t* length) {
+    
+    uint8_t b;
+    do {
+        if (*in >= end)
+            return 0;
+        b = *(*in)++;
+        *length += b;
+    } while (b == 255);
+    return 1;
+}
+
+size_t frameDecompress(const uint8_t* src, size_t size, uint8_t* dst,
+    size_t capacity) {
+    
+    const uint8_t* in = src;
+    const uint8_t* end = src + size;
+    size_t op = 0;
+    while (in < end) {
+        uint8_t token = *in++;
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(&in, end, &numLiterals))
+            return 0;
+        if (numLiterals > (size_t) (end - in) ||
+            numLiterals > capacity - op)
+            return 0;
+        memcpy(dst + op, in, numLiterals);
+        in += numLiterals;
+        op += numLiterals;
+        // The last sequence has literals only.
+        if (in == end)
+            break;
+        
+        if (end - in < 2)
+            return 0;
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(&in, end, &length))
+            return 0;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > op || length > capacity - op)
+            return 0;
+        
+        uint8_t* to = dst + op;
+        const uint8_t* from = to - offset;
+        if (offset >= length)
+            memcpy(to, from, length);
+        else if (offset == 1)
+            memset(to, *from, length);
+        else {
+            // Short repeating pattern: copy it in chunks that double, each
+            // starting on a whole period so it stays in phase.
+            size_t copied = 0;
+            while (copied < length) {
+                size_t n = copied + offset < length - copied ?
+                    copied + offset : length - copied;
+                memcpy(to + copied, from, n);
+                copied += n;
+            }
+        }
+        op += length;
+    }
+    return op;
+}
+
+FrameStore* frameStoreCreate(int width, int height, size_t budget) {
+    FrameStore* store = (FrameStore*) calloc(1, sizeof(FrameStore));
+    store->width = width;
+    store->height = height;
+    store->budget = budget;
+    pthread_mutex_init(&store->lock, NULL);
+    store->newest = store->oldest = -1;
+    store->scratch = (uint8_t*) malloc(FRAME_COMPRESS_BOUND(
+        (size_t) width * height));
+    return store;
+}
+
+void frameStoreFree(FrameStore* store) {
+    for (int i = 0; i < store->numSlots; i++)
+        free(store->frames[i].data);
+    free(store->frames);
+    free(store->scratch);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+}
+
+static void unlinkFrame(FrameStore* store, int index) {
+    StoredFrame* frame = &store->frames[index];
+    if (frame->newer >= 0)
+        store->frames[frame->newer].older = frame->older;
+    else
+        store->newest = frame->older;
+    if (frame->older >= 0)
+        store->frames[frame->older].newer = frame->newer;
+    else
+        store->oldest = frame->newer;
+}
+
+static void makeNewest(FrameStore* store, int index) {
+    StoredFrame* frame = &store->frames[index];
+    frame->newer = -1;
+    frame->older = store->newest;
+    if (store->newest >= 0)
+        store->frames[store->newest].newer = index;
+    else
+        store->oldest = index;
+    store->newest = index;
+}
+
+static void drop(FrameStore* store, int index) {
+    StoredFrame* frame = &store->frames[index];
+    unlinkFrame(store, index);
+    store->stats.bytes -= frame->size;
+    store->stats.frames--;
+    free(frame->data);
+    frame->data = NULL;
+}
+
+int frameStorePut(FrameStore* store, int index, const uint8_t* frame) {
+    if (index < 0)
+        return -1;
+    size_t frameSize = (size_t) store->width * store->height;
+    pthread_mutex_lock(&store->lock);
+    size_t size = frameCompress(frame, frameSize, store->scratch,
+        FRAME_COMPRESS_BOUND(frameSize));
+    if (size > store->budget) {
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+    }
+    if (index >= store->numSlots) {
+        int numSlots = store->numSlots ? store->numSlots : 64;
+        while (numSlots <= index)
+            numSlots *= 2;
+        store->frames = (StoredFrame*) realloc(store->frames,
+            numSlots * sizeof(StoredFrame));
+        memset(store->frames + store->numSlots, 0,
+            (numSlots - store->numSlots) * sizeof(StoredFrame));
+        store->numSlots = numSlots;
+    }
+    if (store->frames[index].data)
+        drop(store, index);
+    while (store->stats.bytes + size > store->budget) {
+        drop(store, store->oldest);
+        store->stats.evictions++;
+    }
+    
+    StoredFrame* stored = &store->frames[index];
+    stored->data = (uint8_t*) malloc(size);
+    memcpy(stored->data, store->scratch, size);
+    stored->size = size;
+    makeNewest(store, index);
+    store->stats.bytes += size;
+    store->stats.frames++;
+    pthread_mutex_unlock(&store->lock);
+    return 0;
+}
+
+int frameStoreGet(FrameStore* store, int index, uint8_t* out) {
+    size_t frameSize = (size_t) store->width * store->height;
+    pthread_mutex_lock(&store->lock);
+    if (index < 0 || index >= store->numSlots ||
+        !store->frames[index].data) {
+        store->stats.misses++;
+        pthread_mutex_unlock(&store->lock);
+        return 0;
+    }
+    StoredFrame* frame = &store->frames[index];
+    unlinkFrame(store, index);
+    makeNewest(store, index);
+    store->stats.hits++;
+    // Decoding under the lock keeps the frame from being evicted midway;
+    // it takes microseconds.
+    frameDecompress(frame->data, frame->size, out, frameSize);
+    pthread_mutex_unlock(&store->lock);
+    return 1;
+}
+
+void frameStoreStats(FrameStore* store, FrameStoreStats* stats) {
+    pthread_mutex_lock(&store->lock);
+    *stats = store->stats;
+    pthread_mutex_unlock(&store->lock);
+}
@@ -0,0 +1,50 @@
+#ifndef FRAME_STORE_H
+#define FRAME_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed in-memory frames for scrubbing back and forth through a
+// rendered rotation without rendering frames again. Each frame is kept
+// LZ77-compressed (frameCompress()) under its frame number; the store
+// stays within a byte budget by dropping the frames viewed least recently.
+typedef struct FrameStore FrameStore;
+
+typedef struct FrameStoreStats {
+    // Frames held and their compressed bytes, which stay within the
+    // budget.
+    int frames;
+    size_t bytes;
+    long long hits, misses, evictions;
+} FrameStoreStats;
+
+// Frames are width * height bytes. budget counts compressed bytes.
+FrameStore* frameStoreCreate(int width, int height, size_t budget);
+void frameStoreFree(FrameStore* store);
+
+// Store frame number index (replacing any frame already stored under it),
+// evicting frames viewed least recently until it fits. Returns 0, or -1 if
+// it does not fit in the budget on its own.
+int frameStorePut(FrameStore* store, int index, const uint8_t* frame);
+
+// Decode frame number index into out and mark it as the most recently
+// viewed. Returns 1, or 0 if it is not stored. Safe to call from several
+// threads, as is frameStorePut().
+int frameStoreGet(FrameStore* store, int index, uint8_t* out);
+
+void frameStoreStats(FrameStore* store, FrameStoreStats* stats);
+
+// Byte-oriented LZ77 in the style of LZ4's block format: sequences of a
+// token (literal and match length nibbles), literals and a 16-bit match
+// offset. Runs of one color and rows repeating the row above both become
+// matches. frameCompress() returns the compressed size, or 0 if it would
+// not fit in capacity; FRAME_COMPRESS_BOUND(n) always fits.
+// frameDecompress() returns the decompressed size, or 0 if src is corrupt
+// or would overflow capacity.
+#define FRAME_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+size_t frameCompress(const uint8_t* src, size_t size, uint8_t* dst,
+    size_t capacity);
+size_t frameDecompress(const uint8_t* src, size_t size, uint8_t* dst,
+    size_t capacity);
+
+#endif
@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "geometry.h"
+
+// statfs() type of a hugetlbfs mount, whose files must be sized in whole
+// huge pages.
+#define HUGETLBFS_MAGIC 0x958458f6
+
+#define GEOMETRY_FILE_MAGIC "GLOBEGEO"
+#define GEOMETRY_FILE_VERSION 1
+
+// Start of a shared table file. The x, y and z arrays follow, each
+// starting on a cache line.
+typedef struct GeometryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dataOffset;
+    GeometryKey key;
+    int32_t width, height;
+    int32_t mirrorX, mirrorY;
+} GeometryFileHeader;
+
+typedef struct GeometryNode {
+    GeometryTable table;
+    // Directory the table was asked for through, NULL for a private table.
+    // A table that could not be shared there is kept privately under the
+    // same directory, so it is not built again on the next lookup.
+    const char* dir;
+    struct GeometryNode* next;
+} GeometryNode;
+
+static pthread_mutex_t tablesLock = PTHREAD_MUTEX_INITIALIZER;
+static GeometryNode* tables = NULL;
+static GeometryCacheStats cacheStats;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int keyEqual(const GeometryKey* a, const GeometryKey* b) {
+    return a->camera == b->camera && a->fov == b->fov &&
+        a->cameraDistance == b->cameraDistance && a->radius == b->radius &&
+        a->width == b->width && a->height == b->height;
+}
+
+static int dirEqual(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// FNV-1a over the key's fields (not its padding) and the table's shape.
+static uint64_t tableHash(const GeometryTable* table) {
+    const GeometryKey* key = &table->key;
+    double values[] = {
+        key->camera, key->fov, key->cameraDistance, key->radius,
+        key->width, key->height, table->mirrorX, table->mirrorY
+    };
+    const uint8_t* p = (const uint8_t*) values;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(values); i++)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static size_t planeBytes(const GeometryTable* table) {
+    size_t bytes = (size_t) table->width * table->height * sizeof(float);
+    return (bytes + 63) & ~(size_t) 63;
+}
+
+static void fillTable(GeometryTable* table, GeometryFillFn* fill,
+    void* arg) {
+    
+    size_t i = 0;
+    for (int y = 0; y < table->height; y++) {
+        for (int x = 0; x < table->width; x++) {
+            float n[3];
+            fill(arg, x, y, n);
+            table->x[i] = n[0];
+            table->y[i] = n[1];
+            table->z[i] = n[2];
+            i++;
+        }
+    }
+}
+
+static void buildTable(GeometryTable* table, GeometryFillFn* fill,
+    void* arg) {
+    
+    size_t size = (size_t) table->width * table->height;
+    table->x = (float*) malloc(size * sizeof(float));
+    table->y = (float*) malloc(size * sizeof(float));
+    table->z = (float*) malloc(size * sizeof(float));
+    fillTable(table, fill, arg);
+}
+
+// Point table's arrays into a mapped table file.
+static void pointIntoFile(GeometryTable* table, uint8_t* map,
+    uint32_t dataOffset) {
+    
+    size_t plane = planeBytes(table);
+    table->x = (float*) (map + dataOffset);
+    table->y = (float*) (map + dataOffset + plane);
+    table->z = (float*) (map + dataOffset + 2 * plane);
+}
+
+// Map a published table read-only. Returns 0 if there is none or it does
+// not match table's key and shape.
+static int mapShared(const char* path, GeometryTable* table) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(
+        GeometryFileHeader)) {
+        close(fd);
+        return 0;
+    }
+    uint8_t* map = (uint8_t*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+        fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    
+    const GeometryFileHeader* header = (const GeometryFileHeader*) map;
+    if (memcmp(header->magic, GEOMETRY_FILE_MAGIC, 8) != 0 ||
+        header->version != GEOMETRY_FILE_VERSION ||
+        !keyEqual(&header->key, &table->key) ||
+        header->width != table->width || header->height != table->height ||
+        header->mirrorX != table->mirrorX ||
+        header->mirrorY != table->mirrorY ||
+        header->dataOffset + 3 * planeBytes(table) > (size_t) st.st_size) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+    pointIntoFile(table, map, header->dataOffset);
+    return 1;
+}
+
+// Build the table into a temporary file in dir and publish it with
+// rename(), so other processes only ever see complete tables.
+static int publishShared(const char* dir, const char* path,
+    GeometryTable* table, GeometryFillFn* fill, void* arg) {
+    
+    char tmpPath[4096 + 32];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int) getpid());
+    int fd = open(tmpPath, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return 0;
+    
+    uint32_t dataOffset = 4096;
+    size_t size = dataOffset + 3 * planeBytes(table);
+    struct statfs fs;
+    if (statfs(dir, &fs) == 0 && (unsigned long) fs.f_type ==
+        HUGETLBFS_MAGIC && fs.f_bsize > 0)
+        size = (size + fs.f_bsize - 1) / fs.f_bsize * fs.f_bsize;
+    uint8_t* map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        map = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmpPath);
+        return 0;
+    }
+    
+    GeometryFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GEOMETRY_FILE_MAGIC, 8);
+    header.version = GEOMETRY_FILE_VERSION;
+    header.dataOffset = dataOffset;
+    header.key = table->key;
+    header.width = table->width;
+    header.height = table->height;
+    header.mirrorX = table->mirrorX;
+    header.mirrorY = table->mirrorY;
+    memcpy(map, &header, sizeof(header));
+    GeometryTable fillInto = *table;
+    pointIntoFile(&fillInto, map, dataOffset);
+    fillTable(&fillInto, fill, arg);
+    munmap(map, size);
+    
+    if (rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        return 0;
+    }
+    return 1;
+}
+
+// Map the table from dir, building and publishing it first if no process
+// has. A lock file makes processes that miss at the same time wait for
+// one builder instead of all building it. Returns 1 on a hit, 2 after
+// building and 0 if dir cannot be used.
+static int sharedTable(const char* dir, GeometryTable* table,
+    GeometryFillFn* fill, void* arg) {
+    
+    char path[4096], lockPath[4096 + 8];
+    snprintf(path, sizeof(path), "%s/globe-geometry-%016llx.tbl", dir,
+        (unsigned long long) tableHash(table));
+    if (mapShared(path, table))
+        return 1;
+    
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+    int lockFd = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lockFd < 0)
+        return 0;
+    flock(lockFd, LOCK_EX);
+    int result = 0;
+    if (mapShared(path, table))
+        result = 1;
+    else if (publishShared(dir, path, table, fill, arg) &&
+        mapShared(path, table))
+        result = 2;
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+    return result;
+}
+
+const GeometryTable* geometryTableGet(const GeometryKey* key, int mirrorX,
+    int mirrorY, const char* dir, GeometryFillFn* fill, void* arg) {
+    
+    pthread_mutex_lock(&tablesLock);
+    GeometryNode* node = tables;
+    while (node && !(keyEqual(&node->table.key, key) &&
+        dirEqual(node->dir, dir)))
+        node = node->next;
+    if (!node) {
+        // A mirror line through the middle of the frame keeps the columns
+        // (or rows) up to and including the middle one.
+        node = (GeometryNode*) malloc(sizeof(GeometryNode));
+        node->table = (GeometryTable) {
+            *key,
+            mirrorX ? mirrorX / 2 + 1 : key->width,
+            mirrorY ? mirrorY / 2 + 1 : key->height,
+            mirrorX, mirrorY, NULL, NULL, NULL
+        };
+        if (node->table.width > key->width)
+            node->table.width = key->width;
+        if (node->table.height > key->height)
+            node->table.height = key->height;
+        
+        double start = now();
+        int shared = dir ? sharedTable(dir, &node->table, fill, arg) : 0;
+        if (!shared)
+            buildTable(&node->table, fill, arg);
+        double elapsed = now() - start;
+        node->dir = dir ? strdup(dir) : NULL;
+        if (shared == 1) {
+            cacheStats.sharedHits++;
+            cacheStats.hitSeconds += elapsed;
+        } else if (shared == 2) {
+            cacheStats.sharedMisses++;
+            cacheStats.missSeconds += elapsed;
+        } else {
+            cacheStats.privateBuilds++;
+            cacheStats.privateSeconds += elapsed;
+        }
+        node->next = tables;
+        tables = node;
+    }
+    pthread_mutex_unlock(&tablesLock);
+    
+    return &node->table;
+}
+
+const GeometryTable* geometryTableFind(const GeometryKey* key) {
+    pthread_mutex_lock(&tablesLock);
+    GeometryNode* node = tables;
+    while (node && !keyEqual(&node->table.key, key))
+        node = node->next;
+    pthread_mutex_unlock(&tablesLock);
+    return node ? &node->table : NULL;
+}
+
+void geometryCacheStats(GeometryCacheStats* stats) {
+    pthread_mutex_lock(&tablesLock);
+    *stats = cacheStats;
+    pthread_mutex_unlock(&tablesLock);
+}
+
+size_t geometryTableBytes(const GeometryTable* table) {
+    return (size_t) table->width * table->height * 3 * sizeof(float);
+}
@@ -0,0 +1,86 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "camera.h"
+
+// What a geometry table depends on. Only the globe's spin changes from
+// frame to frame, so one table serves a whole animation.
+typedef struct GeometryKey {
+    CameraModel camera;
+    double fov;
+    double cameraDistance;
+    double radius;
+    int width, height;
+} GeometryKey;
+
+// Surface normal (in the camera's frame) of the globe under every pixel,
+// one array per component (SoA), NaN in x where the ray misses.
+//
+// With the camera on the z axis looking at the globe's center the normals
+// are mirror images across the vertical and horizontal center lines (x or
+// y changes sign), so only one quadrant is stored and the rest is read by
+// reflection. Lenses whose rays come from a RayTable keep a full table.
+typedef struct GeometryTable {
+    GeometryKey key;
+    // Stored width and height: the quadrant, or the whole frame.
+    int width, height;
+    // Pixel x >= width reads column mirrorX - x with x negated, and
+    // likewise for rows.
+    int mirrorX, mirrorY;
+    float* x;
+    float* y;
+    float* z;
+} GeometryTable;
+
+// Fill in the normal for pixel (x, y), NaN in n[0] for a miss.
+typedef void GeometryFillFn(void* arg, int x, int y, float* n);
+
+// The table for key, built with fill on first use and then shared.
+// mirrorX or mirrorY = 0 store the whole width or height. Safe to call
+// from several threads. Tables live until the program exits.
+//
+// With dir (e.g. /dev/shm or a hugetlbfs mount) not NULL, tables are
+// also shared between processes on the host: each is a file in dir named
+// by a hash of its key, built once by whichever process needs it first
+// (the others wait on a lock file), published by rename() and mapped
+// read-only, so every process uses the same physical pages. If dir cannot
+// be used the table is built privately.
+const GeometryTable* geometryTableGet(const GeometryKey* key, int mirrorX,
+    int mirrorY, const char* dir, GeometryFillFn* fill, void* arg);
+
+// The table for key if it has been built, otherwise NULL.
+const GeometryTable* geometryTableFind(const GeometryKey* key);
+
+// Tables this process got from a shared directory, built and published
+// there, and built privately, with the time spent getting them.
+typedef struct GeometryCacheStats {
+    int sharedHits, sharedMisses, privateBuilds;
+    double hitSeconds, missSeconds, privateSeconds;
+} GeometryCacheStats;
+
+void geometryCacheStats(GeometryCacheStats* stats);
+
+size_t geometryTableBytes(const GeometryTable* table);
+
+// Index of pixel (x, y) in the stored part and the signs to apply to the
+// stored x and y components.
+static inline int geometryIndex(const GeometryTable* table, int x, int y,
+    float* signX, float* signY) {
+    
+    *signX = 1.0f;
+    *signY = 1.0f;
+    if (x >= table->width) {
+        x = table->mirrorX - x;
+        *signX = -1.0f;
+    }
+    if (y >= table->height) {
+        y = table->mirrorY - y;
+        *signY = -1.0f;
+    }
+    return y * table->width + x;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gif_edit.h"
+#include "mmap_writer.h"
+
+static int u16At(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+// Offset just past the sub-blocks starting at pos (ending with a zero
+// length block), or 0 if they run past the end.
+static size_t skipSubBlocks(const uint8_t* data, size_t size, size_t pos) {
+    while (pos < size && data[pos] != 0)
+        pos += 1 + data[pos];
+    return pos < size ? pos + 1 : 0;
+}
+
+// Index the blocks of a mapped GIF. Returns 0 if it is malformed.
+static int indexGif(GifFile* gif) {
+    const uint8_t* data = gif->data;
+    size_t size = gif->size;
+    if (size < 13 || (memcmp(data, "GIF87a", 6) != 0 &&
+        memcmp(data, "GIF89a", 6) != 0))
+        return 0;
+    gif->width = u16At(data + 6);
+    gif->height = u16At(data + 8);
+    size_t pos = 13;
+    if (data[10] & 0x80) {
+        gif->palette = pos;
+        gif->paletteEntries = 2 << (data[10] & 7);
+        pos += 3 * gif->paletteEntries;
+    }
+    
+    int capacity = 64;
+    gif->frames = (GifFrame*) malloc(capacity * sizeof(GifFrame));
+    GifFrame frame = { 0 };
+    // Start of the blocks belonging to the next frame.
+    size_t frameStart = pos;
+    gif->headerEnd = 0;
+    while (pos < size && data[pos] != 0x3b) {
+        if (data[pos] == 0x21 && pos + 2 < size) {
+            int label = data[pos + 1];
+            // Application extensions in front of the first frame (looping)
+            // stay with the header.
+            if (label == 0xff && gif->numFrames == 0 && !frame.control &&
+                frameStart == pos) {
+                pos = skipSubBlocks(data, size, pos + 2);
+                frameStart = pos;
+                if (!pos) return 0;
+                continue;
+            }
+            if (label == 0xf9 && pos + 7 < size && data[pos + 2] == 4) {
+                frame.control = pos + 3;
+                frame.disposal = (data[pos + 3] >> 2) & 7;
+                frame.transparent = data[pos + 3] & 1;
+                frame.delay = u16At(data + pos + 4);
+            }
+            pos = skipSubBlocks(data, size, pos + 2);
+            if (!pos) return 0;
+        } else if (data[pos] == 0x2c && pos + 10 < size) {
+            if (!gif->headerEnd) gif->headerEnd = frameStart;
+            frame.start = frameStart;
+            frame.x = u16At(data + pos + 1);
+            frame.y = u16At(data + pos + 3);
+            frame.width = u16At(data + pos + 5);
+            frame.height = u16At(data + pos + 7);
+            int flags = data[pos + 9];
+            pos += 10;
+            if (flags & 0x80)
+                pos += 3 * (2 << (flags & 7));
+            // LZW minimum code size, then the image data.
+            pos = skipSubBlocks(data, size, pos + 1);
+            if (!pos) return 0;
+            frame.end = pos;
+            
+            if (gif->numFrames == capacity) {
+                capacity *= 2;
+                gif->frames = (GifFrame*) realloc(gif->frames,
+                    capacity * sizeof(GifFrame));
+            }
+            gif->frames[gif->numFrames++] = frame;
+            frame = (GifFrame) { 0 };
+            frameStart = pos;
+        } else {
+            return 0;
+        }
+    }
+    if (!gif->headerEnd) gif->headerEnd = frameStart;
+    return pos < size;
+}
+
+GifFile* gifOpen(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    // The mapping outlives the descriptor.
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    
+    GifFile* gif = (GifFile*) calloc(1, sizeof(GifFile));
+    gif->data = (const uint8_t*) map;
+    gif->size = st.st_size;
+    if (!indexGif(gif)) {
+        gifClose(gif);
+        return NULL;
+    }
+    return gif;
+}
+
+void gifClose(GifFile* gif) {
+    munmap((void*) gif->data, gif->size);
+    free(gif->frames);
+    free(gif);
+}
+
+int gifFramesIndependent(const GifFile* gif) {
+    for (int i = 0; i < gif->numFrames; i++) {
+        const GifFrame* f = &gif->frames[i];
+        if (f->transparent || f->x != 0 || f->y != 0 ||
+            f->width != gif->width || f->height != gif->height)
+            return 0;
+    }
+    return 1;
+}
+
+// Copy the header and the frames in edit's order to writer, then the
+// trailer. Returns 0 on success and -1 as soon as a write fails.
+static int writeEdited(MmapWriter* writer, const GifFile* gif,
+    const GifEdit* edit, int numOrder) {
+    
+    uint8_t* out = mmapWriterReserve(writer, gif->headerEnd);
+    if (!out)
+        return -1;
+    memcpy(out, gif->data, gif->headerEnd);
+    if (edit->palette)
+        memcpy(out + gif->palette, edit->palette, 3 * edit->paletteEntries);
+    mmapWriterCommit(writer, gif->headerEnd);
+    
+    for (int k = 0; k < numOrder; k++) {
+        const GifFrame* f = &gif->frames[edit->order ? edit->order[k] : k];
+        if (edit->delay >= 0 && !f->control) {
+            // Graphic Control Extension with only the delay set.
+            uint8_t control[8] = {
+                0x21, 0xf9, 4, 0, edit->delay & 0xff, edit->delay >> 8, 0, 0
+            };
+            if (mmapWriterWrite(writer, control, sizeof(control)) != 0)
+                return -1;
+        }
+        size_t length = f->end - f->start;
+        out = mmapWriterReserve(writer, length);
+        if (!out)
+            return -1;
+        memcpy(out, gif->data + f->start, length);
+        if (edit->delay >= 0 && f->control) {
+            uint8_t* delay = out + (f->control - f->start) + 1;
+            delay[0] = edit->delay & 0xff;
+            delay[1] = edit->delay >> 8;
+        }
+        mmapWriterCommit(writer, length);
+    }
+    
+    uint8_t trailer = 0x3b;
+    return mmapWriterWrite(writer, &trailer, 1);
+}
+
+int gifEditWrite(const GifFile* gif, const GifEdit* edit, const char* path) {
+    int numOrder = edit->order ? edit->numOrder : gif->numFrames;
+    if (edit->order && !gifFramesIndependent(gif))
+        return -2;
+    if (edit->palette && edit->paletteEntries > gif->paletteEntries)
+        return -2;
+    
+    // Header, frames (each may gain an 8 byte control extension) and the
+    // trailer.
+    size_t total = gif->headerEnd + 1;
+    for (int k = 0; k < numOrder; k++) {
+        int i = edit->order ? edit->order[k] : k;
+        if (i < 0 || i >= gif->numFrames)
+            return -2;
+        total += gif->frames[i].end - gif->frames[i].start + 8;
+    }
+    MmapWriter* writer = mmapWriterOpen(path, total);
+    if (!writer)
+        return -1;
+    
+    // A partly written copy is not a GIF, so it is not left behind.
+    int result = writeEdited(writer, gif, edit, numOrder);
+    if (mmapWriterClose(writer) != 0)
+        result = -1;
+    if (result != 0)
+        unlink(path);
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef GIF_EDIT_H
+#define GIF_EDIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Edits an existing GIF without decoding it: the file is mapped, its
+// blocks are indexed, and an edited copy is put together by copying
+// whole frame blocks. Only delays and the global palette are rewritten,
+// so no LZW data is ever decoded or encoded.
+
+// One frame: the extensions in front of its image (Graphic Control and
+// others) and the image itself.
+typedef struct GifFrame {
+    // Bytes [start, end) of the file.
+    size_t start, end;
+    // Offset of the Graphic Control Extension's packed byte, or 0 if the
+    // frame has none.
+    size_t control;
+    int x, y, width, height;
+    // Hundredths of a second.
+    int delay;
+    int transparent;
+    // Disposal method from the Graphic Control Extension.
+    int disposal;
+} GifFrame;
+
+typedef struct GifFile {
+    const uint8_t* data;
+    size_t size;
+    int width, height;
+    // Offset and number of entries of the global palette, 0 if none.
+    size_t palette;
+    int paletteEntries;
+    // Everything in front of the first frame: header, screen descriptor,
+    // global palette and application extensions (e.g. looping).
+    size_t headerEnd;
+    GifFrame* frames;
+    int numFrames;
+} GifFile;
+
+// Map and index path. Returns NULL if it cannot be read or is not a
+// well-formed GIF.
+GifFile* gifOpen(const char* path);
+void gifClose(GifFile* gif);
+
+// Whether every frame can be shown without the frames before it: it
+// covers the whole screen and has no transparent color. Reordering or
+// dropping frames is only safe then.
+int gifFramesIndependent(const GifFile* gif);
+
+typedef struct GifEdit {
+    // New delay for every frame in hundredths of a second, -1 to keep.
+    int delay;
+    // Source frames to write, in order. NULL writes all of them.
+    const int* order;
+    int numOrder;
+    // RGB triplets replacing the first paletteEntries global palette
+    // entries. NULL keeps the palette.
+    const uint8_t* palette;
+    int paletteEntries;
+} GifEdit;
+
+// Write an edited copy of gif to path. Returns 0 on success, -1 if the
+// output could not be written (path is removed again) and -2 if the edit
+// needs independent frames (see gifFramesIndependent()) or a global palette
+// the file does not have.
+int gifEditWrite(const GifFile* gif, const GifEdit* edit, const char* path);
+
+#endif
@@ -0,0 +1,1215 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "globe.h"
+#include "earth_data.h"
+#include "pool.h"
+#include "city_lights.h"
+#include "geometry.h"
+#include "shade.h"
+#include "cube_map.h"
+
+const uint8_t globePalette[GLOBE_NUM_COLORS * 3] = {
+    // Background color
+    0, 0, 0,
+    // Blues
+    0, 19, 88,
+    0, 24, 132,
+    0, 28, 169,
+    0, 32, 207,
+    // Greens
+    0, 82, 9,
+    8, 133, 5,
+    14, 169, 3,
+    21, 210, 0,
+    // Ring tans
+    38, 33, 26,
+    112, 96, 70,
+    163, 141, 104,
+    214, 190, 145,
+    // City lights
+    255, 197, 92
+};
+
+// Find intersection between ray and sphere.
+// https://en.wikipedia.org/wiki/Line%E2%80%93sphere_intersection
+Vec3 raySphere(Vec3 o, Vec3 u, Vec3 c, double r) {
+    // Normalize u (make it have length 1). This allows us to use the simpler
+    // Wikipedia formula at the line "Note that in the specific case where u 
+    // is a unit vector, we can simplify this further"
+    u = vscl(u, 1.0 / sqrt(vmag2(u)));
+    return raySphereUnit(o, u, c, r);
+}
+
+// Same as raySphere() for a u that already has length 1.
+Vec3 raySphereUnit(Vec3 o, Vec3 u, Vec3 c, double r) {
+    // Initialize values according to wikipedia article.
+    Vec3 oc = vdiff(o, c);
+    double oc2 = vmag2(oc);
+    double udotoc = vdot(u, oc);
+    double udotoc2 = udotoc * udotoc;
+    double r2 = r * r;
+    
+    // On wikipedia, this variable is the upside down triangle symbol.
+    // We can just distribute the (-) and get rid of the parentheses.
+    double del = udotoc2 - oc2 + r2;
+    // del < 0.0 means no solutions
+    if (del < 0.0)
+        return (Vec3) { INFINITY, INFINITY, INFINITY };
+    // We only care about positive d, so the closer value is obtained by
+    // subtracting sqrt(del). A smaller d means a closer intersection.
+    double d = -udotoc - sqrt(del);
+    // d < 0.0 means that the ray hit the sphere "in reverse."
+    if (d < 0.0)
+        return (Vec3) { INFINITY, INFINITY, INFINITY };
+    
+    // Return origin point + direction * distance.
+    return vsum(o, vscl(u, d));
+}
+
+// Get normal given a point on a sphere.
+Vec3 sphereNormal(Vec3 c, double r, Vec3 p) {
+    return vscl(vdiff(p, c), 1.0 / r);
+}
+
+// X (U) texture coordinate given normal of sphere.
+// https://en.wikipedia.org/wiki/UV_mapping
+int texCoordX(Vec3 n, int width) {
+    double arctangent = atan2(n.x, n.z);
+    if (arctangent < 0.0) arctangent += TWO_PI;
+    
+    int x = (int) (arctangent * width / TWO_PI);
+    if (x < 0) x = 0;
+    else if (x >= width) x = width - 1;
+    
+    return x;
+}
+
+// Y (V) texture coordinate given normal of sphere.
+// https://en.wikipedia.org/wiki/UV_mapping
+int texCoordY(Vec3 n, int height) {
+    double arcsine = asin(-n.y);
+    arcsine += PI_OVER_TWO;
+    
+    int y = (int) (arcsine * height / PI);
+    if (y < 0) y = 0;
+    else if (y >= height) y = height - 1;
+    
+    return y;
+}
+
+// Arctangent of a ratio in [0, 1], in single precision. Minimax
+// polynomial, off by at most about 1e-5 radians.
+static inline float atanUnitPoly(float t) {
+    float t2 = t * t;
+    return ((-0.0464964749f * t2 + 0.15931422f) * t2 - 0.327622764f) *
+        t2 * t + t;
+}
+
+// Arcsine of a value in [0, 1]. Abramowitz and Stegun 4.4.45, off by at
+// most about 7e-5 radians.
+static inline float asinUnitPoly(float s) {
+    float p = ((-0.0187293f * s + 0.0742610f) * s - 0.2121144f) * s +
+        1.5707288f;
+    return (float) PI_OVER_TWO - sqrtf(1.0f - s) * p;
+}
+
+#define ATAN_TABLE_SIZE 1024
+#define ASIN_TABLE_SIZE 4096
+static float atanTable[ATAN_TABLE_SIZE + 1];
+static float asinTable[ASIN_TABLE_SIZE + 1];
+static pthread_once_t trigTablesOnce = PTHREAD_ONCE_INIT;
+
+static void buildTrigTables(void) {
+    for (int i = 0; i <= ATAN_TABLE_SIZE; i++)
+        atanTable[i] = atan((double) i / ATAN_TABLE_SIZE);
+    for (int i = 0; i <= ASIN_TABLE_SIZE; i++)
+        asinTable[i] = asin((double) i / ASIN_TABLE_SIZE);
+}
+
+// texCoordX() and texCoordY() with the arctangent and arcsine from trig.
+// Both fold the argument into [0, 1] and restore the quadrant after.
+static inline void texCoordsApprox(Vec3 n, GlobeTrig trig, int* texX,
+    int* texY) {
+    
+    float nx = n.x, nz = n.z, ny = -n.y;
+    float ax = fabsf(nx), az = fabsf(nz);
+    float lo = ax < az ? ax : az, hi = ax < az ? az : ax;
+    float t = hi > 0.0f ? lo / hi : 0.0f;
+    float as = fabsf(ny);
+    if (as > 1.0f) as = 1.0f;
+    
+    float arctangent, arcsine;
+    if (trig == GLOBE_TRIG_TABLE) {
+        arctangent = atanTable[(int) (t * ATAN_TABLE_SIZE + 0.5f)];
+        arcsine = asinTable[(int) (as * ASIN_TABLE_SIZE + 0.5f)];
+    } else {
+        arctangent = atanUnitPoly(t);
+        arcsine = asinUnitPoly(as);
+    }
+    if (ax > az) arctangent = (float) PI_OVER_TWO - arctangent;
+    if (nz < 0.0f) arctangent = (float) PI - arctangent;
+    // atan2(x, z) < 0 wraps around to the far end of the texture.
+    if (nx < 0.0f) arctangent = (float) TWO_PI - arctangent;
+    if (ny < 0.0f) arcsine = -arcsine;
+    
+    int x = (int) (arctangent * (float) (EARTH_DATA_WIDTH / TWO_PI));
+    if (x < 0) x = 0;
+    else if (x >= EARTH_DATA_WIDTH) x = EARTH_DATA_WIDTH - 1;
+    int y = (int) ((arcsine + (float) PI_OVER_TWO) *
+        (float) (EARTH_DATA_HEIGHT / PI));
+    if (y < 0) y = 0;
+    else if (y >= EARTH_DATA_HEIGHT) y = EARTH_DATA_HEIGHT - 1;
+    *texX = x;
+    *texY = y;
+}
+
+// raySphere() and sphereNormal() in single precision. Returns 0 on a miss,
+// otherwise sets the hit p and its normal n.
+static inline int raySphereFloat(Vec3 o, Vec3 u, Vec3 c, double r, Vec3* p,
+    Vec3* n) {
+    
+    float ux = u.x, uy = u.y, uz = u.z;
+    float invLength = 1.0f / sqrtf(ux * ux + uy * uy + uz * uz);
+    ux *= invLength;
+    uy *= invLength;
+    uz *= invLength;
+    float ox = o.x - c.x, oy = o.y - c.y, oz = o.z - c.z;
+    float rf = r;
+    
+    float udotoc = ux * ox + uy * oy + uz * oz;
+    float del = udotoc * udotoc - (ox * ox + oy * oy + oz * oz) + rf * rf;
+    if (del < 0.0f)
+        return 0;
+    float d = -udotoc - sqrtf(del);
+    if (d < 0.0f)
+        return 0;
+    
+    // Hit relative to the center, which is also the unscaled normal.
+    float hx = ox + ux * d, hy = oy + uy * d, hz = oz + uz * d;
+    float invR = 1.0f / rf;
+    *p = (Vec3) { hx + c.x, hy + c.y, hz + c.z };
+    *n = (Vec3) { hx * invR, hy * invR, hz * invR };
+    return 1;
+}
+
+// Relative optical density of the rings from the inner to the outer edge,
+// from 0 (a gap) to 3 (opaque). Loosely after Saturn: the faint C ring, the
+// bright B ring, the Cassini division and the A ring with the Encke gap.
+#define RING_BANDS 32
+static const uint8_t ringBands[RING_BANDS] = {
+    1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 3, 3, 3, 3, 3, 3,
+    3, 2, 0, 0, 2, 2, 2, 2, 2, 2, 2, 0, 2, 2, 1, 1
+};
+
+// Ring density at squared distance rr from the globe's center on the ring
+// plane. Zero outside the annulus and in its gaps.
+static int ringDensity(const GlobeConfig* config, double rr) {
+    double inner = config->ringInner;
+    double outer = config->ringOuter;
+    if (rr < inner * inner || rr >= outer * outer)
+        return 0;
+    int band = (int) ((sqrt(rr) - inner) * RING_BANDS / (outer - inner));
+    if (band >= RING_BANDS) band = RING_BANDS - 1;
+    return ringBands[band];
+}
+
+// Find intersection between ray and the ring plane (y = 0 in the globe's
+// frame). Returns the distance along u, or INFINITY if the ray is parallel
+// to the plane or hits it "in reverse."
+// https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
+static double rayRingPlane(Vec3 o, Vec3 u) {
+    if (u.y == 0.0)
+        return INFINITY;
+    double d = -o.y / u.y;
+    return d > 0.0 ? d : INFINITY;
+}
+
+// Orientation of the globe's own frame, in which the polar axis is y.
+// World vectors are pitched toward the camera (YZ plane) and then tilted
+// (XY plane).
+typedef struct Orientation {
+    double cPitch, sPitch;
+    double cTilt, sTilt;
+} Orientation;
+
+// World frame to globe frame.
+static Vec3 toGlobe(Vec3 v, const Orientation* f) {
+    return vrotxy(vrotyz(v, f->cPitch, f->sPitch), f->cTilt, f->sTilt);
+}
+
+// Globe frame to world frame.
+static Vec3 fromGlobe(Vec3 v, const Orientation* f) {
+    return vrotyz(vrotxy(v, f->cTilt, -f->sTilt), f->cPitch, -f->sPitch);
+}
+
+// Orientation of the globe for config, as setupTrace() sets it up.
+static Orientation globeOrientation(const GlobeConfig* config) {
+    double tilt = 23.4 * DEG_TO_RAD;
+    // Negated so that a positive pitch turns the north pole toward us.
+    double pitch = -config->pitch * DEG_TO_RAD;
+    return (Orientation) { cos(pitch), sin(pitch), cos(tilt), sin(tilt) };
+}
+
+Vec3 globeLightFromSun(Vec3 toSun, const GlobeConfig* config) {
+    // The spin in traceRows() turns the globe's frame about y, and a
+    // texel's longitude is atan2(x, z) - pi, so equatorial (X, Y, Z) is
+    // globe (-Y, Z, -X) before the spin.
+    Orientation f = globeOrientation(config);
+    Vec3 sunGlobe = { -toSun.y, toSun.z, -toSun.x };
+    return fromGlobe(vscl(sunGlobe, -1.0), &f);
+}
+
+// Pinhole camera at o looking down -z through the near plane z = 1.
+typedef struct View {
+    Vec3 o;
+    double tanFov2x, tanFov2y;
+    double pixelSize;
+    int width, height;
+} View;
+
+// Inclusive range of pixels.
+typedef struct ScreenRect {
+    int x0, y0, x1, y1;
+} ScreenRect;
+
+// Grow rect to include the projection of world point p. Returns 0 if p is
+// not in front of the camera.
+static int rectAddPoint(ScreenRect* rect, const View* view, Vec3 p) {
+    double dz = view->o.z - p.z;
+    if (dz <= 0.0)
+        return 0;
+    // Invert the ray construction in traceGlobe().
+    double ux = (p.x - view->o.x) / dz;
+    double uy = (p.y - view->o.y) / dz;
+    double sx = (ux + view->tanFov2x) / view->pixelSize - 0.5;
+    double sy = (view->tanFov2y - uy) / view->pixelSize + 0.5;
+    // Round outward and leave a pixel of slack either side.
+    int x0 = (int) floor(sx) - 1, x1 = (int) ceil(sx) + 1;
+    int y0 = (int) floor(sy) - 1, y1 = (int) ceil(sy) + 1;
+    if (x0 < rect->x0) rect->x0 = x0;
+    if (x1 > rect->x1) rect->x1 = x1;
+    if (y0 < rect->y0) rect->y0 = y0;
+    if (y1 > rect->y1) rect->y1 = y1;
+    return 1;
+}
+
+// Clip rect to the screen.
+static void rectClip(ScreenRect* rect, const View* view) {
+    if (rect->x0 < 0) rect->x0 = 0;
+    if (rect->y0 < 0) rect->y0 = 0;
+    if (rect->x1 > view->width - 1) rect->x1 = view->width - 1;
+    if (rect->y1 > view->height - 1) rect->y1 = view->height - 1;
+}
+
+// Screen-space bounds of the ring annulus. The 16-gon circumscribing the
+// outer edge contains the annulus, so the box around its projected vertices
+// contains the projected ellipse. Falls back to the whole screen if part of
+// the rings is behind the camera.
+static ScreenRect ringScreenRect(const GlobeConfig* config, const View* view,
+    const Orientation* f) {
+    
+    const int sides = 16;
+    double r = config->ringOuter / cos(PI / sides);
+    ScreenRect rect = { view->width, view->height, -1, -1 };
+    for (int k = 0; k < sides; k++) {
+        double a = TWO_PI * k / sides;
+        Vec3 q = fromGlobe((Vec3) { r * cos(a), 0.0, r * sin(a) }, f);
+        if (!rectAddPoint(&rect, view, q)) {
+            rect = (ScreenRect) { 0, 0, view->width - 1, view->height - 1 };
+            break;
+        }
+    }
+    rectClip(&rect, view);
+    return rect;
+}
+
+// Screen-space bounds of the visible night side of a sphere of radius r at
+// the origin, where the light direction points into the surface
+// (vdot(p, light) > 0). Over the visible surface the projection has no
+// interior extremes, so the bounds are reached on the region's outline:
+// the visible arc of the terminator (vdot(p, light) = 0) and the night arc
+// of the limb (vdot(p, o) = r^2), plus the two points where they meet.
+static ScreenRect nightScreenRect(const View* view, Vec3 light, double r) {
+    ScreenRect rect = { view->width, view->height, -1, -1 };
+    Vec3 o = view->o;
+    double r2 = r * r;
+    if (vmag2(o) <= r2)
+        return (ScreenRect) { 0, 0, view->width - 1, view->height - 1 };
+    
+    // Terminator: circle of radius r around the origin perpendicular to
+    // light, spanned by e1 and e2.
+    Vec3 e1 = fabs(light.y) < 0.9 ? (Vec3) { 0.0, 1.0, 0.0 } :
+        (Vec3) { 1.0, 0.0, 0.0 };
+    e1 = vdiff(e1, vscl(light, vdot(e1, light)));
+    e1 = vscl(e1, 1.0 / sqrt(vmag2(e1)));
+    Vec3 e2 = {
+        light.y * e1.z - light.z * e1.y,
+        light.z * e1.x - light.x * e1.z,
+        light.x * e1.y - light.y * e1.x
+    };
+    // Limb: circle around c with radius rho perpendicular to o, spanned by
+    // f1 and f2.
+    double od = sqrt(vmag2(o));
+    Vec3 on = vscl(o, 1.0 / od);
+    Vec3 c = vscl(on, r2 / od);
+    double rho = r * sqrt(1.0 - r2 / (od * od));
+    Vec3 f1 = fabs(on.y) < 0.9 ? (Vec3) { 0.0, 1.0, 0.0 } :
+        (Vec3) { 1.0, 0.0, 0.0 };
+    f1 = vdiff(f1, vscl(on, vdot(f1, on)));
+    f1 = vscl(f1, 1.0 / sqrt(vmag2(f1)));
+    Vec3 f2 = {
+        on.y * f1.z - on.z * f1.y,
+        on.z * f1.x - on.x * f1.z,
+        on.x * f1.y - on.y * f1.x
+    };
+    
+    // The arcs are smooth, so 256 samples miss their extremes by far less
+    // than rectAddPoint()'s pixel of slack.
+    const int samples = 256;
+    for (int k = 0; k < samples; k++) {
+        double a = TWO_PI * k / samples;
+        Vec3 p = vsum(vscl(e1, r * cos(a)), vscl(e2, r * sin(a)));
+        if (vdot(p, o) >= r2)
+            rectAddPoint(&rect, view, p);
+        Vec3 q = vsum(c, vsum(vscl(f1, rho * cos(a)), vscl(f2, rho * sin(a))));
+        if (vdot(q, light) >= 0.0)
+            rectAddPoint(&rect, view, q);
+    }
+    // Where the limb crosses the terminator: vdot(q, light) = 0 with
+    // q = c + rho * (cos(a) * f1 + sin(a) * f2).
+    double l1 = vdot(f1, light) * rho;
+    double l2 = vdot(f2, light) * rho;
+    double lm = sqrt(l1 * l1 + l2 * l2);
+    if (lm > 0.0 && fabs(vdot(c, light)) <= lm) {
+        double phi = atan2(l2, l1);
+        double da = acos(-vdot(c, light) / lm);
+        for (int k = -1; k <= 1; k += 2) {
+            double a = phi + k * da;
+            rectAddPoint(&rect, view, vsum(c, 
+                vsum(vscl(f1, rho * cos(a)), vscl(f2, rho * sin(a)))));
+        }
+    }
+    
+    rectClip(&rect, view);
+    return rect;
+}
+
+// Fraction of the sun visible from point p past a spherical occluder at m
+// with radius rm, where s points toward the sun and sunRadius is the sun's
+// angular radius. 0 inside the umbra, 1 outside the penumbra, and a linear
+// ramp in the angle between the two discs' centers in between.
+// https://en.wikipedia.org/wiki/Umbra,_penumbra_and_antumbra
+static double sunVisible(Vec3 p, Vec3 m, double rm, Vec3 s,
+    double sunRadius) {
+    
+    Vec3 d = vdiff(m, p);
+    double dist2 = vmag2(d);
+    double ds = vdot(d, s);
+    if (ds <= 0.0 || dist2 <= rm * rm)
+        return 1.0;
+    // Compare sines first so that most of the penumbra's bounding box is
+    // rejected without calling acos().
+    double dist = sqrt(dist2);
+    double moonRadius = asin(rm / dist);
+    double outer = moonRadius + sunRadius;
+    double cosTheta = ds / dist;
+    if (outer < PI_OVER_TWO && cosTheta <= cos(outer))
+        return 1.0;
+    double theta = acos(cosTheta > 1.0 ? 1.0 : cosTheta);
+    
+    // Full overlap: total eclipse (umbra) or annular (antumbra).
+    double inner = fabs(moonRadius - sunRadius);
+    double full = moonRadius >= sunRadius ? 0.0 :
+        1.0 - moonRadius * moonRadius / (sunRadius * sunRadius);
+    if (theta <= inner)
+        return full;
+    return full + (1.0 - full) * (theta - inner) / (outer - inner);
+}
+
+// Screen-space bounds of an occluder's shadow on the day side of a sphere
+// of radius r at the origin. In a frame with s (toward the sun) as its third
+// axis, shadowed points lie within the penumbra's widest radius rp of the
+// shadow axis and have 0 <= vdot(p, s) <= r, so they fit in a box whose 8
+// corners are projected. The box is empty if the shadow misses the globe.
+static ScreenRect shadowScreenRect(const View* view, Vec3 m, double rm,
+    Vec3 s, double sunRadius, double r) {
+    
+    ScreenRect rect = { view->width, view->height, -1, -1 };
+    
+    // Basis perpendicular to s.
+    Vec3 e1 = fabs(s.y) < 0.9 ? (Vec3) { 0.0, 1.0, 0.0 } :
+        (Vec3) { 1.0, 0.0, 0.0 };
+    e1 = vdiff(e1, vscl(s, vdot(e1, s)));
+    e1 = vscl(e1, 1.0 / sqrt(vmag2(e1)));
+    Vec3 e2 = {
+        s.y * e1.z - s.z * e1.y,
+        s.z * e1.x - s.x * e1.z,
+        s.x * e1.y - s.y * e1.x
+    };
+    
+    // Widest penumbra radius over the globe's depth along the axis.
+    double far = vdot(m, s) + r;
+    if (far <= 0.0)
+        return rect;
+    double rp = rm / cos(sunRadius) + far * tan(sunRadius);
+    
+    // Distance of the shadow axis from the globe's center.
+    double a1 = vdot(m, e1), a2 = vdot(m, e2);
+    double axis = sqrt(a1 * a1 + a2 * a2);
+    double minPerp = axis - rp > 0.0 ? axis - rp : 0.0;
+    double maxPerp = axis + rp < r ? axis + rp : r;
+    if (minPerp >= r)
+        return rect;
+    
+    double lo1 = a1 - rp > -r ? a1 - rp : -r;
+    double hi1 = a1 + rp < r ? a1 + rp : r;
+    double lo2 = a2 - rp > -r ? a2 - rp : -r;
+    double hi2 = a2 + rp < r ? a2 + rp : r;
+    double loS = sqrt(r * r - maxPerp * maxPerp);
+    double hiS = sqrt(r * r - minPerp * minPerp);
+    for (int k = 0; k < 8; k++) {
+        Vec3 p = vsum(vsum(
+            vscl(e1, k & 1 ? hi1 : lo1),
+            vscl(e2, k & 2 ? hi2 : lo2)),
+            vscl(s, k & 4 ? hiS : loS));
+        if (!rectAddPoint(&rect, view, p))
+            return (ScreenRect) { 0, 0, view->width - 1, view->height - 1 };
+    }
+    rectClip(&rect, view);
+    return rect;
+}
+
+// Everything traceRows() needs that is constant over a frame.
+struct TraceSetup {
+    const GlobeConfig* config;
+    int width, height;
+    double tanFov2x, tanFov2y, pixelSize;
+    Vec3 light;
+    Vec3 c;
+    double r;
+    double cRot, sRot;
+    Orientation f;
+    Vec3 o;
+    Vec3 oT, uT, uTdx, uTdy, lightT;
+    int ellipsoid, rings;
+    Vec3 radii, invRadii;
+    Vec3 oE, uE, uEdx, uEdy;
+    ScreenRect ringRect;
+    Vec3 toLightE;
+    ScreenRect nightRect;
+    int eclipse;
+    Vec3 toSun;
+    double sunRadius;
+    ScreenRect shadowRect;
+    // Optional per-tile hashes to fill in.
+    TileMap* tiles;
+    // Per-pixel rays of lenses other than the pinhole.
+    const RayTable* rays;
+    // Orthographic fast path: pixel (x, y) looks straight down at
+    // orthoX0 + orthoStep * x, orthoY0 - orthoStep * y (in globe radii).
+    int ortho;
+    double orthoX0, orthoY0, orthoStep;
+    // Cached sphere normals, if enabled.
+    const GeometryTable* geometry;
+};
+
+// GeometryFillFn: the camera-frame normal under pixel (x, y), traced the
+// same way as traceRows() does.
+static void fillGeometry(void* arg, int x, int y, float* normal) {
+    const TraceSetup* s = (const TraceSetup*) arg;
+    Vec3 p;
+    if (s->ortho) {
+        double nx = s->orthoX0 + s->orthoStep * x;
+        double ny = s->orthoY0 - s->orthoStep * y;
+        double rr = nx * nx + ny * ny;
+        p = rr <= 1.0 ? vscl((Vec3) { nx, ny, sqrt(1.0 - rr) }, s->r) :
+            (Vec3) { INFINITY, INFINITY, INFINITY };
+    } else if (s->rays) {
+        int i = y * s->width + x;
+        Vec3 u = { s->rays->x[i], s->rays->y[i], s->rays->z[i] };
+        p = raySphereUnit(s->o, u, s->c, s->r);
+    } else {
+        Vec3 u = {
+            -s->tanFov2x + s->pixelSize * (x + 0.5),
+            s->tanFov2y - s->pixelSize * (y - 0.5),
+            -1.0
+        };
+        p = raySphere(s->o, u, s->c, s->r);
+    }
+    if (isinf(p.x)) {
+        normal[0] = NAN;
+        normal[1] = normal[2] = 0.0f;
+        return;
+    }
+    Vec3 n = sphereNormal(s->c, s->r, p);
+    normal[0] = (float) n.x;
+    normal[1] = (float) n.y;
+    normal[2] = (float) n.z;
+}
+
+// Palette index for texture's color under normal n, scaled by shade
+// (0 to 1). With err and errNext (this row's and the next row's carried
+// error, in 16ths, three per pixel) the quantization error is diffused
+// Floyd-Steinberg style: 7/16 to the right and 3/16, 5/16 and 1/16 below.
+static inline uint8_t colorTexel(const ColorTexture* texture,
+    const ColorLut* lut, Vec3 n, double shade, int* err, int* errNext,
+    int x) {
+    
+    int texX = texCoordX(n, texture->width);
+    int texY = texCoordY(n, texture->height);
+    const uint8_t* texel = texture->rgb +
+        ((size_t) texY * texture->width + texX) * 3;
+    int rgb[3];
+    for (int c = 0; c < 3; c++)
+        rgb[c] = (int) (texel[c] * shade + 0.5);
+    if (!err)
+        return colorLutIndex(lut, rgb[0], rgb[1], rgb[2]);
+    
+    for (int c = 0; c < 3; c++) {
+        rgb[c] += err[x * 3 + c] / 16;
+        if (rgb[c] < 0) rgb[c] = 0;
+        else if (rgb[c] > 255) rgb[c] = 255;
+    }
+    uint8_t index = colorLutIndex(lut, rgb[0], rgb[1], rgb[2]);
+    for (int c = 0; c < 3; c++) {
+        int e = rgb[c] - lut->palette[index * 3 + c];
+        err[(x + 1) * 3 + c] += 7 * e;
+        errNext[(x - 1) * 3 + c] += 3 * e;
+        errNext[x * 3 + c] += 5 * e;
+        errNext[(x + 1) * 3 + c] += e;
+    }
+    return index;
+}
+
+// Each thread's shade planes, kept from band to band and frame to frame
+// and freed when the thread exits.
+static pthread_key_t planesKey;
+static pthread_once_t planesKeyOnce = PTHREAD_ONCE_INIT;
+
+static void freePlanes(void* planes) {
+    shadePlanesFree((ShadePlanes*) planes);
+}
+
+static void createPlanesKey(void) {
+    pthread_key_create(&planesKey, freePlanes);
+}
+
+// The calling thread's shade planes for rows of width pixels.
+static ShadePlanes* threadPlanes(int width) {
+    pthread_once(&planesKeyOnce, createPlanesKey);
+    ShadePlanes* planes = (ShadePlanes*) pthread_getspecific(planesKey);
+    if (!planes || planes->width != width) {
+        if (planes) shadePlanesFree(planes);
+        planes = shadePlanesCreate(width);
+        pthread_setspecific(planesKey, planes);
+    }
+    return planes;
+}
+
+// Compute the per-frame constants for traceRows().
+// time = seconds elapsed.
+// totalTime = length of whole animation in seconds.
+static void setupTrace(TraceSetup* s, int width, int height,
+    double time, double totalTime, const GlobeConfig* config) {
+    
+    // Field of view.
+    double fov = config->fov > 0.0 ? config->fov : 
+        cameraDefaultFov(config->camera);
+    double dist = config->cameraDistance;
+    
+    int ellipsoid = config->polarRadius != config->equatorialRadius;
+    int rings = config->ringOuter > 0.0;
+    
+    // The orthographic camera shows the plane through the globe's center
+    // that the pinhole would. A plain sphere takes the fast path in
+    // traceRows(). Everything else, including the screen bounds, uses a far
+    // away pinhole with the same framing, which is orthographic to well
+    // under a pixel.
+    int ortho = 0;
+    double orthoHalfWidth = 0.0;
+    if (config->camera == CAMERA_ORTHOGRAPHIC) {
+        orthoHalfWidth = dist * tan(fov / 2.0 * DEG_TO_RAD);
+        dist = 1e4;
+        fov = 2.0 * atan(orthoHalfWidth / dist) / DEG_TO_RAD;
+        ortho = !ellipsoid && !rings;
+    }
+    // Tangent of half of fov (slope of frustum).
+    // tanFov2x and tanFov2y are 1/2 of the dimensions of the "near plane"
+    // at z = 1. We will use them to construct the view's rays.
+    double tanFov2x = tan(fov / 2.0 * DEG_TO_RAD);
+    double tanFov2y = tanFov2x * height / width;
+    double pixelSize = 2.0 * tanFov2x / width;
+    
+    // Light source direction.
+    Vec3 light = vmag2(config->light) > 0.0 ? config->light : GLOBE_LIGHT;
+    light = vscl(light, 1.0 / sqrt(vmag2(light)));
+    
+    // Center and radius of globe for raySphere() function.
+    Vec3 c = { 0.0, 0.0, 0.0 };
+    double r = config->equatorialRadius;
+    
+    // Compute sine and cosine of earth's spin, axis tilt and the pitch of
+    // the axis toward the camera.
+    // We will complete one full rotation (2*pi).
+    double rot = -TWO_PI * time / totalTime;
+    double cRot = cos(rot);
+    double sRot = sin(rot);
+    Orientation f = globeOrientation(config);
+    
+    // Origin (view/camera center) in front of globe.
+    Vec3 o = { 0.0, 0.0, dist };
+    View view = { o, tanFov2x, tanFov2y, pixelSize, width, height };
+    
+    // Rays in the globe's frame, where the polar axis is y and the rings lie
+    // in the plane y = 0. The direction is linear in the pixel position, so
+    // only the first ray and the per-pixel steps are rotated.
+    Vec3 oT = toGlobe(o, &f);
+    Vec3 uT = toGlobe((Vec3) { 
+        -tanFov2x + 0.5 * pixelSize, tanFov2y + 0.5 * pixelSize, -1.0
+    }, &f);
+    Vec3 uTdx = toGlobe((Vec3) { pixelSize, 0.0, 0.0 }, &f);
+    Vec3 uTdy = toGlobe((Vec3) { 0.0, -pixelSize, 0.0 }, &f);
+    Vec3 lightT = toGlobe(light, &f);
+    
+    // An ellipsoid is traced in the globe's frame after squashing each axis
+    // by its radius so that the ellipsoid becomes the unit sphere. The
+    // squash is linear too, so it is applied once to the camera origin and
+    // to the ray's start and per-pixel steps, and the loop still only calls
+    // raySphere().
+    Vec3 radii = {
+        config->equatorialRadius,
+        config->polarRadius,
+        config->equatorialRadius
+    };
+    Vec3 invRadii = { 1.0 / radii.x, 1.0 / radii.y, 1.0 / radii.z };
+    Vec3 oE = vmul(oT, invRadii);
+    Vec3 uE = vmul(uT, invRadii);
+    Vec3 uEdx = vmul(uTdx, invRadii);
+    Vec3 uEdy = vmul(uTdy, invRadii);
+    
+    // Ring rays are only traced inside the rings' screen bounds.
+    ScreenRect ringRect = { 0, 0, -1, -1 };
+    if (rings)
+        ringRect = ringScreenRect(config, &view, &f);
+    // Direction toward the light, squashed for shadow rays against the
+    // globe.
+    Vec3 toLightE = vmul(vscl(lightT, -1.0), invRadii);
+    
+    if (config->trig == GLOBE_TRIG_TABLE)
+        pthread_once(&trigTablesOnce, buildTrigTables);
+    if (config->cubeMap)
+        cubeMapInit();
+    
+    // City lights are only sampled inside the night side's screen bounds,
+    // so rows and bands that are all daylight never test for them. The
+    // bounds are worked out for spheres; an ellipsoid checks every pixel.
+    ScreenRect nightRect = { 0, 0, -1, -1 };
+    if (config->cityLights) {
+        cityLightsInit();
+        if (ellipsoid)
+            nightRect = (ScreenRect) { 0, 0, width - 1, height - 1 };
+        else
+            nightRect = nightScreenRect(&view, light, r);
+    }
+    
+    // The eclipse shadow is only evaluated inside its footprint, so its
+    // cost scales with the size of the shadow, not of the frame.
+    int eclipse = config->occluderRadius > 0.0;
+    Vec3 toSun = vscl(light, -1.0);
+    double sunRadius = config->sunRadius * DEG_TO_RAD;
+    ScreenRect shadowRect = { 0, 0, -1, -1 };
+    if (eclipse) {
+        if (ellipsoid)
+            shadowRect = (ScreenRect) { 0, 0, width - 1, height - 1 };
+        else
+            shadowRect = shadowScreenRect(&view, config->occluderCenter,
+                config->occluderRadius, toSun, sunRadius, r);
+    }
+    
+    // Other lenses read their rays from a table built once per resolution,
+    // since building them takes trig. The screen bounds above assume a
+    // pinhole, so they are widened to the whole frame.
+    const RayTable* rays = NULL;
+    if (cameraUsesRayTable(config->camera)) {
+        rays = rayTableGet(config->camera, fov, width, height);
+        ScreenRect all = { 0, 0, width - 1, height - 1 };
+        if (rings) ringRect = all;
+        if (config->cityLights) nightRect = all;
+        if (eclipse) shadowRect = all;
+    }
+    
+    *s = (TraceSetup) {
+        config, width, height, tanFov2x, tanFov2y, pixelSize, light, c, r,
+        cRot, sRot, f, o, oT, uT, uTdx, uTdy, lightT, ellipsoid, rings,
+        radii, invRadii, oE, uE, uEdx, uEdy, ringRect, toLightE, nightRect,
+        eclipse, toSun, sunRadius, shadowRect, NULL, rays, ortho,
+        (-orthoHalfWidth + orthoHalfWidth / width) / r,
+        (orthoHalfWidth * height / width - orthoHalfWidth / width) / r,
+        2.0 * orthoHalfWidth / width / r, NULL
+    };
+    
+    // The pinhole's and the orthographic camera's normals are mirror images
+    // across the frame's center lines, so their tables keep one quadrant.
+    // The pinhole's rays are centered half a pixel down (y - 0.5 above),
+    // which puts its horizontal mirror line between rows, at (height + 1) / 2.
+    // Ray-table lenses keep the whole frame.
+    if (config->geometryCache && !ellipsoid && !rings) {
+        GeometryKey key = { config->camera, fov, dist, r, width, height };
+        int mirrorX = 0, mirrorY = 0;
+        if (config->camera == CAMERA_PINHOLE) {
+            mirrorX = width - 1;
+            mirrorY = height + 1;
+        } else if (ortho) {
+            mirrorX = width - 1;
+            mirrorY = height - 1;
+        }
+        s->geometry = geometryTableGet(&key, mirrorX, mirrorY,
+            config->geometryDir, fillGeometry, s);
+    }
+}
+
+// Render rows y0 up to (not including) y1 of the frame described by s.
+static void traceRows(const TraceSetup* s, uint8_t* screen, int y0, int y1) {
+    // Local copies, since stores to screen could otherwise alias *s.
+    const GlobeConfig* config = s->config;
+    int width = s->width;
+    double tanFov2x = s->tanFov2x, tanFov2y = s->tanFov2y;
+    double pixelSize = s->pixelSize;
+    Vec3 light = s->light, c = s->c;
+    double r = s->r;
+    double cRot = s->cRot, sRot = s->sRot;
+    Orientation f = s->f;
+    Vec3 o = s->o;
+    Vec3 oT = s->oT, uT = s->uT, uTdx = s->uTdx, uTdy = s->uTdy;
+    Vec3 lightT = s->lightT;
+    int ellipsoid = s->ellipsoid, rings = s->rings;
+    Vec3 radii = s->radii, invRadii = s->invRadii;
+    Vec3 oE = s->oE, uE = s->uE, uEdx = s->uEdx, uEdy = s->uEdy;
+    ScreenRect ringRect = s->ringRect;
+    Vec3 toLightE = s->toLightE;
+    ScreenRect nightRect = s->nightRect;
+    int eclipse = s->eclipse;
+    Vec3 toSun = s->toSun;
+    double sunRadius = s->sunRadius;
+    ScreenRect shadowRect = s->shadowRect;
+    uint64_t* rowHash = s->tiles ? s->tiles->rowHash : NULL;
+    int tileSize = s->tiles ? s->tiles->tileSize : 0;
+    int tilesX = s->tiles ? s->tiles->tilesX : 0;
+    const float* rayX = s->rays ? s->rays->x : NULL;
+    const float* rayY = s->rays ? s->rays->y : NULL;
+    const float* rayZ = s->rays ? s->rays->z : NULL;
+    int ortho = s->ortho;
+    double orthoX0 = s->orthoX0, orthoY0 = s->orthoY0;
+    double orthoStep = s->orthoStep;
+    const GeometryTable* geometry = s->geometry;
+    GlobeTrig trig = config->trig;
+    int floatRays = config->floatRays;
+    int cubeMap = config->cubeMap;
+    const ColorTexture* texture = config->texture;
+    const ColorLut* colorLut = config->colorLut;
+    ShadePlanes* planes = config->bitSliced && !texture ?
+        threadPlanes(width) : NULL;
+    // Two rows of dithering error with a pixel of padding at either end,
+    // swapped every row. Each band starts without error, so the output
+    // depends on the band size but not on the number of threads.
+    int* errors = NULL;
+    if (texture && config->dither)
+        errors = (int*) calloc(2 * (width + 2) * 3, sizeof(int));
+    
+    int i = y0 * width;
+    for (int y = y0; y < y1; y++) {
+        if (planes) shadeClear(planes);
+        int* err = NULL;
+        int* errNext = NULL;
+        if (errors) {
+            err = errors + (y & 1) * (width + 2) * 3 + 3;
+            errNext = errors + ((y + 1) & 1) * (width + 2) * 3 + 3;
+            memset(errNext - 3, 0, (width + 2) * 3 * sizeof(int));
+        }
+        Vec3 uERow = vsum(uE, vscl(uEdy, y));
+        Vec3 uTRow = vsum(uT, vscl(uTdy, y));
+        int ringRow = y >= ringRect.y0 && y <= ringRect.y1;
+        int nightRow = y >= nightRect.y0 && y <= nightRect.y1;
+        int shadowRow = y >= shadowRect.y0 && y <= shadowRect.y1;
+        int tileX = 0;
+        double orthoY = orthoY0 - orthoStep * y;
+        for (int x = 0; x < width; x++) {
+            Vec3 p, n, pT;
+            double bright = 0.0;
+            // Normalized ray direction from the lens's table, if any.
+            Vec3 uLens = { 0.0, 0.0, 0.0 };
+            if (rayX)
+                uLens = (Vec3) { rayX[i], rayY[i], rayZ[i] };
+            if (geometry) {
+                // Normal from the table, reflected outside its quadrant.
+                float signX, signY;
+                int k = geometryIndex(geometry, x, y, &signX, &signY);
+                if (!isnan(geometry->x[k])) {
+                    n = (Vec3) {
+                        signX * geometry->x[k],
+                        signY * geometry->y[k],
+                        geometry->z[k]
+                    };
+                    p = vscl(n, r);
+                    bright = -vdot(n, light);
+                    n = toGlobe(n, &f);
+                } else {
+                    p = (Vec3) { INFINITY, INFINITY, INFINITY };
+                }
+            } else if (ortho) {
+                // Parallel rays down -z hit the sphere inside its outline,
+                // and the hit's normal follows from x and y alone. No
+                // quadratic to solve and no ray to normalize.
+                double nx = orthoX0 + orthoStep * x;
+                double rr = nx * nx + orthoY * orthoY;
+                if (rr <= 1.0) {
+                    n = (Vec3) { nx, orthoY, sqrt(1.0 - rr) };
+                    p = vscl(n, r);
+                    bright = -vdot(n, light);
+                    n = toGlobe(n, &f);
+                } else {
+                    p = (Vec3) { INFINITY, INFINITY, INFINITY };
+                }
+            } else if (!ellipsoid) {
+                // Find point where ray hits sphere and the surface normal.
+                if (rayX) {
+                    p = raySphereUnit(o, uLens, c, r);
+                } else {
+                    // Create ray direction vector based on near plane z = 1.
+                    Vec3 u = { 
+                        -tanFov2x + pixelSize * (x + 0.5), 
+                        tanFov2y - pixelSize * (y - 0.5),
+                        -1.0
+                    };
+                    if (floatRays) {
+                        if (!raySphereFloat(o, u, c, r, &p, &n))
+                            p = (Vec3) { INFINITY, INFINITY, INFINITY };
+                    } else {
+                        p = raySphere(o, u, c, r);
+                    }
+                }
+                if (!isinf(p.x)) {
+                    if (!floatRays || rayX) n = sphereNormal(c, r, p);
+                    // Calculate brightness of point on sphere from light
+                    // source.
+                    bright = -vdot(n, light);
+                    // Move the normal and point into the globe's frame.
+                    n = toGlobe(n, &f);
+                    if (rings) pT = toGlobe(p, &f);
+                }
+            } else if (rayX && vmag2(uLens) == 0.0) {
+                // Outside the lens's image; the sphere path misses these
+                // on its own, but normalizing a zero ray here gives NaN.
+                p = (Vec3) { INFINITY, INFINITY, INFINITY };
+            } else {
+                // Hit the unit sphere in the squashed frame.
+                Vec3 u = rayX ? vmul(toGlobe(uLens, &f), invRadii) :
+                    vsum(uERow, vscl(uEdx, x));
+                p = raySphere(oE, u, c, 1.0);
+                if (isfinite(p.x)) {
+                    // The ellipsoid's normal is its gradient
+                    // (x / a^2, y / b^2, z / a^2), which in squashed
+                    // coordinates is just p scaled by the inverse radii.
+                    // Its y component is the sine of the geodetic latitude,
+                    // so texCoordY() samples by geodetic latitude for free.
+                    n = vmul(p, invRadii);
+                    n = vscl(n, 1.0 / sqrt(vmag2(n)));
+                    bright = -vdot(n, lightT);
+                    pT = vmul(p, radii);
+                }
+            }
+            int hit = isfinite(p.x);
+            
+            // Ray may hit the rings in front of the globe, or beside it.
+            int ringColor = -1;
+            if (ringRow && x >= ringRect.x0 && x <= ringRect.x1) {
+                Vec3 u = rayX ? toGlobe(uLens, &f) :
+                    vsum(uTRow, vscl(uTdx, x));
+                double d = rayRingPlane(oT, u);
+                Vec3 q = vsum(oT, vscl(u, d));
+                int density = 0;
+                if (!isinf(d) && (!hit || 
+                    vmag2(vdiff(q, oT)) < vmag2(vdiff(pT, oT))))
+                    density = ringDensity(config, q.x * q.x + q.z * q.z);
+                if (density > 0) {
+                    // Rings in the globe's shadow take the darkest color.
+                    Vec3 s = raySphere(vmul(q, invRadii), toLightE, c, 1.0);
+                    ringColor = GLOBE_RING_COLOR + (isinf(s.x) ? density : 0);
+                }
+            }
+            
+            if (ringColor >= 0) {
+                screen[i] = ringColor;
+                if (planes) shadeSet(planes->keep, x, 1);
+            // Ray hit the globe.
+            } else if (hit) {
+                // Eclipse shadow, only inside its footprint and on the day
+                // side.
+                if (eclipse && shadowRow && x >= shadowRect.x0 &&
+                    x <= shadowRect.x1 && bright > 0.0) {
+                    Vec3 pW = ellipsoid ? fromGlobe(vmul(p, radii), &f) : p;
+                    bright *= sunVisible(pW, config->occluderCenter,
+                        config->occluderRadius, toSun, sunRadius);
+                }
+                
+                int brightI = (int) (bright * 6.0);
+                if (brightI > 3) brightI = 3;
+                else if (brightI < 0) brightI = 0;
+                
+                // The rings' shadow on the globe. A ray toward the light
+                // crossing the ring plane within the annulus is blocked in
+                // proportion to the ring's density.
+                int litI = brightI;
+                if (rings && brightI > 0) {
+                    double d = rayRingPlane(pT, vscl(lightT, -1.0));
+                    if (!isinf(d)) {
+                        Vec3 q = vsum(pT, vscl(lightT, -d));
+                        brightI -= ringDensity(config, q.x * q.x + q.z * q.z);
+                        if (brightI < 0) brightI = 0;
+                    }
+                }
+                
+                // Rotate normals so that texture will be sampled at different
+                // locations so it appears the sphere itself is rotating.
+                n = vrotzx(n, cRot, sRot);
+                
+                // Sample texture value (0 or 1, ocean or land). A color
+                // texture only needs it for the city lights.
+                int nightSide = nightRow && x >= nightRect.x0 &&
+                    x <= nightRect.x1 && bright < 0.0;
+                int texX = 0, texY = 0, texel = 0, sample = 0;
+                if (texture && !nightSide) {
+                    // Colored from texture below.
+                } else if (cubeMap) {
+                    texel = cubeMapTexel(n);
+                    sample = cubeMapSample(cubeMapLand, texel);
+                } else {
+                    if (trig == GLOBE_TRIG_LIBM) {
+                        texX = texCoordX(n, EARTH_DATA_WIDTH);
+                        texY = texCoordY(n, EARTH_DATA_HEIGHT);
+                    } else {
+                        texCoordsApprox(n, trig, &texX, &texY);
+                    }
+                    sample = sampleEarthData(texX, texY);
+                }
+                
+                // Select one of four colors for ocean or one of four colors
+                // for land.
+                if (planes) {
+                    shadeSet(planes->hit, x, 1);
+                    shadeSet(planes->land, x, sample);
+                    shadeSet(planes->bright0, x, brightI & 1);
+                    shadeSet(planes->bright1, x, brightI >> 1);
+                } else if (texture) {
+                    // Full light from bright = 0.5, like brightI, over a
+                    // fifth for the night side.
+                    double shade = bright * 2.0;
+                    if (shade > 1.0) shade = 1.0;
+                    else if (shade < 0.0) shade = 0.0;
+                    if (litI > 0) shade *= (double) brightI / litI;
+                    screen[i] = colorTexel(texture, colorLut, n,
+                        0.2 + 0.8 * shade, err, errNext, x);
+                } else {
+                    screen[i] = 1 + 4 * sample + brightI;
+                }
+                
+                // City lights on land past the terminator. bright < 0 is
+                // only checked inside the night side's bounds, and the
+                // lights texture only read for night-side land.
+                if (nightSide && sample && (cubeMap ?
+                    cubeMapSample(cubeMapLights, texel) :
+                    sampleCityLights(texX, texY))) {
+                    screen[i] = GLOBE_LIGHTS_COLOR;
+                    if (planes) shadeSet(planes->keep, x, 1);
+                }
+            // Ray did not hit the globe
+            } else if (!planes) {
+                // Set color to background color (black).
+                screen[i] = 0;
+            }
+            
+            // Hash each tile's slice of the row as soon as it is written.
+            // Bit-sliced rows are only written, and hashed, once complete.
+            if (rowHash && !planes &&
+                (++tileX == tileSize || x == width - 1)) {
+                rowHash[y * tilesX + x / tileSize] =
+                    tileHashBytes(screen + i + 1 - tileX, tileX);
+                tileX = 0;
+            }
+            
+            i++;
+        }
+        
+        if (planes) {
+            uint8_t* row = screen + y * width;
+            shadeExpand(planes, row);
+            for (int x = 0; rowHash && x < width; x += tileSize) {
+                int n = width - x < tileSize ? width - x : tileSize;
+                rowHash[y * tilesX + x / tileSize] =
+                    tileHashBytes(row + x, n);
+            }
+        }
+    }
+    free(errors);
+}
+
+// traceRows(), charging the thread's CPU time to the config's job if any.
+static void traceRowsAccounted(const TraceSetup* s, uint8_t* screen, int y0,
+    int y1) {
+    
+    JobAccount* account = s->config->account;
+    long long start = account ? accountThreadNs() : 0;
+    traceRows(s, screen, y0, y1);
+    if (account)
+        accountAdd(account, ACCOUNT_TRACE, start);
+}
+
+// Render the earth.
+// time = seconds elapsed.
+// totalTime = length of whole animation in seconds.
+void traceGlobe(uint8_t* screen, int width, int height, 
+    double time, double totalTime, const GlobeConfig* config) {
+    
+    TraceSetup s;
+    setupTrace(&s, width, height, time, totalTime, config);
+    traceRowsAccounted(&s, screen, 0, height);
+}
+
+TraceSetup* traceSetupCreate(int width, int height, double time,
+    double totalTime, const GlobeConfig* config) {
+    
+    TraceSetup* s = (TraceSetup*) malloc(sizeof(TraceSetup));
+    setupTrace(s, width, height, time, totalTime, config);
+    return s;
+}
+
+void traceSetupRows(const TraceSetup* s, uint8_t* screen, int y0, int y1) {
+    traceRowsAccounted(s, screen, y0, y1);
+}
+
+void traceSetupFree(TraceSetup* s) {
+    free(s);
+}
+
+typedef struct BandJob {
+    const TraceSetup* setup;
+    uint8_t* screen;
+    int bandRows;
+} BandJob;
+
+// Pool task: render one band of bandRows rows.
+static void traceBand(void* arg, int index) {
+    BandJob* job = (BandJob*) arg;
+    int y0 = index * job->bandRows;
+    int y1 = y0 + job->bandRows;
+    if (y1 > job->setup->height) y1 = job->setup->height;
+    traceRowsAccounted(job->setup, job->screen, y0, y1);
+}
+
+void traceGlobeParallel(Pool* pool, uint8_t* screen, int width, int height,
+    double time, double totalTime, const GlobeConfig* config,
+    TileMap* tiles) {
+    
+    TraceSetup s;
+    setupTrace(&s, width, height, time, totalTime, config);
+    s.tiles = tiles;
+    BandJob job = { &s, screen, globeBandRows(config) };
+    int numBands = (height + job.bandRows - 1) / job.bandRows;
+    poolFor(pool, traceBand, &job, numBands);
+    if (tiles)
+        tileMapFinish(tiles);
+}
+
+static double monotonicSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct ScanlineJob {
+    BandJob band;
+    int numBands;
+    GlobeRowsFn* fn;
+    void* arg;
+    double start;
+    GlobeScanlineStats* stats;
+    pthread_mutex_t lock;
+    // Bands finished so far, the first band not yet handed to fn, and
+    // whether a thread is calling fn.
+    uint8_t* done;
+    int next;
+    int delivering;
+} ScanlineJob;
+
+// Pool task: render one band, then hand every band finished in order from
+// the top to the callback. Only one thread delivers at a time; a band that
+// finishes meanwhile is picked up by the delivering thread's next look.
+static void traceScanlineBand(void* arg, int index) {
+    ScanlineJob* job = (ScanlineJob*) arg;
+    traceBand(&job->band, index);
+    
+    pthread_mutex_lock(&job->lock);
+    job->done[index] = 1;
+    if (job->delivering) {
+        pthread_mutex_unlock(&job->lock);
+        return;
+    }
+    job->delivering = 1;
+    for (;;) {
+        int first = job->next;
+        int end = first;
+        while (end < job->numBands && job->done[end])
+            end++;
+        if (end == first)
+            break;
+        job->next = end;
+        pthread_mutex_unlock(&job->lock);
+        
+        int rows = job->band.bandRows;
+        int height = job->band.setup->height;
+        int y0 = first * rows;
+        int y1 = end * rows < height ? end * rows : height;
+        // Time the hand-off, not the callback's own work.
+        double elapsed = monotonicSeconds() - job->start;
+        job->fn(job->arg, job->band.screen + (size_t) y0 *
+            job->band.setup->width, y0, y1);
+        if (job->stats) {
+            if (first == 0)
+                job->stats->firstRow = elapsed;
+            if (end == job->numBands)
+                job->stats->lastRow = elapsed;
+        }
+        pthread_mutex_lock(&job->lock);
+    }
+    job->delivering = 0;
+    pthread_mutex_unlock(&job->lock);
+}
+
+void traceGlobeScanlines(Pool* pool, uint8_t* screen, int width, int height,
+    double time, double totalTime, const GlobeConfig* config,
+    GlobeRowsFn* fn, void* arg, GlobeScanlineStats* stats) {
+    
+    ScanlineJob job;
+    job.start = monotonicSeconds();
+    TraceSetup s;
+    setupTrace(&s, width, height, time, totalTime, config);
+    job.band = (BandJob) { &s, screen, globeBandRows(config) };
+    job.numBands = (height + job.band.bandRows - 1) / job.band.bandRows;
+    job.fn = fn;
+    job.arg = arg;
+    job.stats = stats;
+    pthread_mutex_init(&job.lock, NULL);
+    job.done = (uint8_t*) calloc(job.numBands, 1);
+    job.next = 0;
+    job.delivering = 0;
+    // poolFor() hands bands out from the top, so the band holding up
+    // delivery is always one a worker has already started.
+    poolFor(pool, traceScanlineBand, &job, job.numBands);
+    free(job.done);
+    pthread_mutex_destroy(&job.lock);
+}
@@ -0,0 +1,179 @@
+#ifndef GLOBE_H
+#define GLOBE_H
+
+#include <stdint.h>
+
+#include "vec3.h"
+#include "pool.h"
+#include "tile_map.h"
+#include "camera.h"
+#include "accounting.h"
+#include "color_texture.h"
+
+// Flattening of the WGS84 reference ellipsoid, (a - b) / a.
+// https://en.wikipedia.org/wiki/World_Geodetic_System
+#define WGS84_FLATTENING 0.003352810664747481
+
+// Palette layout written by traceGlobe():
+// 0 background, 1-4 ocean (dark to light), 5-8 land (dark to light),
+// 9-12 rings (in shadow, then thin to dense) and 13 city lights.
+#define GLOBE_RING_COLOR 9
+#define GLOBE_LIGHTS_COLOR 13
+#define GLOBE_NUM_COLORS 14
+
+// RGB colors for the palette indices above.
+extern const uint8_t globePalette[GLOBE_NUM_COLORS * 3];
+
+// Default rows per task when a frame is split across a pool. Bands are handed out
+// dynamically, so rows through the middle of the globe (which cost more
+// than empty rows) do not leave other threads idle.
+#define GLOBE_BAND_ROWS 8
+
+// How longitude and latitude are found from a surface normal.
+typedef enum GlobeTrig {
+    // atan2() and asin() from libm, in double precision.
+    GLOBE_TRIG_LIBM,
+    // Single precision polynomials, within about 1e-4 radians.
+    GLOBE_TRIG_POLY,
+    // Lookup tables with 1024 (arctangent) and 4096 (arcsine) entries.
+    GLOBE_TRIG_TABLE
+} GlobeTrig;
+
+// Options for traceGlobe(), built with designated initializers like
+// CGIF_Config. equatorialRadius, polarRadius and cameraDistance must be
+// set; optional features left zeroed are disabled.
+typedef struct GlobeConfig {
+    // Radius at the equator and at the poles. Equal radii give a sphere and
+    // take the plain raySphere() path; different radii give an oblate (or
+    // prolate) spheroid.
+    double equatorialRadius;
+    double polarRadius;
+    // Distance from the camera to the globe's center.
+    double cameraDistance;
+    // Lens, and its field of view in degrees (0 for the lens's default).
+    CameraModel camera;
+    double fov;
+    // Degrees the polar axis leans toward the camera, on top of the 23.4
+    // degree axial tilt.
+    double pitch;
+    // Planetary rings in the equatorial plane, between ringInner and
+    // ringOuter from the center. ringOuter = 0 disables the rings.
+    double ringInner;
+    double ringOuter;
+    // Show city lights on the night side.
+    int cityLights;
+    // Spherical occluder (a moon) casting an eclipse shadow on the globe.
+    // occluderRadius = 0 disables it.
+    Vec3 occluderCenter;
+    double occluderRadius;
+    // Angular radius of the sun in degrees, which sets the width of the
+    // penumbra. 0 is a point light with a hard shadow.
+    double sunRadius;
+    // Direction light travels in, in the camera's frame (need not be
+    // normalized). Zero for GLOBE_LIGHT.
+    Vec3 light;
+    // Read the sphere's per-pixel normals from a table built once for the
+    // camera and resolution (see geometry.h) instead of tracing each ray.
+    // The table holds floats, so a few texels at land/ocean edges can
+    // differ from a traced frame. Not used with rings or an ellipsoid.
+    int geometryCache;
+    // Directory shared by the processes on the host (e.g. /dev/shm) to
+    // keep the geometry tables in, built once and mapped read-only by
+    // every process. NULL keeps them private to the process.
+    const char* geometryDir;
+    // Approximations that give up exact agreement with the default
+    // renderer for speed; quality.h measures what they cost. trig sets
+    // how texture coordinates are computed, and floatRays intersects the
+    // sphere's pinhole rays in single precision.
+    GlobeTrig trig;
+    int floatRays;
+    // Sample land and city lights from the cube map (see cube_map.h)
+    // instead of earthData, which needs no trig and so ignores trig.
+    // Coastlines move by up to a texel where the grids disagree.
+    int cubeMap;
+    // Collect each row's land and brightness bits in 64-pixel bitplanes
+    // and build the palette indices a row at a time (see shade.h) instead
+    // of pixel by pixel. The bits are still decided one pixel at a time;
+    // only turning them into indices works on whole words. Same output,
+    // but slower: setting four bits per pixel costs more than the byte
+    // store it replaces (see --bench).
+    int bitSliced;
+    // Color the globe from texture instead of the land mask: each texel is
+    // shaded by the light and quantized to a palette index with colorLut
+    // (see color_texture.h), whose palette must start with globePalette.
+    // dither diffuses the quantization error Floyd-Steinberg style within
+    // each band of rows. Rings and city lights are drawn as before.
+    // Overrides bitSliced.
+    const ColorTexture* texture;
+    const ColorLut* colorLut;
+    int dither;
+    // Job charged for the CPU time spent tracing, or NULL. Bands are timed
+    // on whichever thread runs them.
+    JobAccount* account;
+    // Rows per pool task when a frame is split across a pool, 0 for
+    // GLOBE_BAND_ROWS. Only changes how fast a frame renders.
+    int bandRows;
+} GlobeConfig;
+
+static inline int globeBandRows(const GlobeConfig* config) {
+    return config->bandRows > 0 ? config->bandRows : GLOBE_BAND_ROWS;
+}
+
+// Direction light travels in, from the sun toward the globe (not
+// normalized).
+#define GLOBE_LIGHT ((Vec3) { 1.0, 0.0, -1.0 })
+
+// Light direction for GlobeConfig.light with the sun toward toSun, given
+// in the globe's inertial frame: equatorial coordinates with z toward the
+// north pole, in which the globe turns by 2 * pi * time / totalTime
+// radians. Depends on config's tilt and pitch.
+Vec3 globeLightFromSun(Vec3 toSun, const GlobeConfig* config);
+
+Vec3 raySphere(Vec3 o, Vec3 u, Vec3 c, double r);
+Vec3 raySphereUnit(Vec3 o, Vec3 u, Vec3 c, double r);
+Vec3 sphereNormal(Vec3 c, double r, Vec3 p);
+int texCoordX(Vec3 n, int width);
+int texCoordY(Vec3 n, int height);
+
+void traceGlobe(uint8_t* screen, int width, int height,
+    double time, double totalTime, const GlobeConfig* config);
+
+// The per-frame constants traceGlobe() works out before tracing, for
+// callers that split a frame up themselves: set up once, then render any
+// rows from any number of threads. config must outlive the setup.
+typedef struct TraceSetup TraceSetup;
+TraceSetup* traceSetupCreate(int width, int height, double time,
+    double totalTime, const GlobeConfig* config);
+// Render only rows y0 up to (not including) y1 of the frame.
+void traceSetupRows(const TraceSetup* s, uint8_t* screen, int y0, int y1);
+void traceSetupFree(TraceSetup* s);
+
+// Same as traceGlobe(), with the rows split into bands across pool. If
+// tiles is not NULL, it is filled with a hash of every tile of the frame,
+// computed while the pixels are written.
+void traceGlobeParallel(Pool* pool, uint8_t* screen, int width, int height,
+    double time, double totalTime, const GlobeConfig* config,
+    TileMap* tiles);
+
+// Called with rows y0 up to (not including) y1 of the frame, starting at
+// rows, once they are complete. Calls come in order from the top of the
+// frame and never overlap, though they may be made on different threads.
+typedef void GlobeRowsFn(void* arg, const uint8_t* rows, int y0, int y1);
+
+// Seconds from the start of traceGlobeScanlines() until the first and the
+// last rows were handed to the callback.
+typedef struct GlobeScanlineStats {
+    double firstRow;
+    double lastRow;
+} GlobeScanlineStats;
+
+// traceGlobeParallel() for displays that take rows as soon as they are
+// ready: each band (globeBandRows() rows) is rendered by one worker, and
+// fn gets every run of bands finished in order from the top as soon as
+// the band above it is done, rather than the whole frame at the end.
+// stats may be NULL.
+void traceGlobeScanlines(Pool* pool, uint8_t* screen, int width, int height,
+    double time, double totalTime, const GlobeConfig* config,
+    GlobeRowsFn* fn, void* arg, GlobeScanlineStats* stats);
+
+#endif
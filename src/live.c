@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "live.h"
+
+// Days since J2000.0 (2000-01-01 12:00 UTC, ignoring leap seconds).
+static double daysSinceJ2000(double unixTime) {
+    return (unixTime - 946728000.0) / 86400.0;
+}
+
+double liveSiderealTurns(double unixTime) {
+    // https://aa.usno.navy.mil/faq/GAST
+    double d = daysSinceJ2000(unixTime);
+    double degrees = fmod(280.46061837 + 360.98564736629 * d, 360.0);
+    if (degrees < 0.0) degrees += 360.0;
+    return degrees / 360.0;
+}
+
+Vec3 liveSunDirection(double unixTime) {
+    // Low precision solar coordinates from the Astronomical Almanac.
+    // https://aa.usno.navy.mil/faq/sun_approx
+    double d = daysSinceJ2000(unixTime);
+    double g = (357.529 + 0.98560028 * d) * DEG_TO_RAD;
+    double q = 280.459 + 0.98564736 * d;
+    double lambda = (q + 1.915 * sin(g) + 0.020 * sin(2.0 * g)) * DEG_TO_RAD;
+    double epsilon = (23.439 - 0.00000036 * d) * DEG_TO_RAD;
+    return (Vec3) {
+        cos(lambda), cos(epsilon) * sin(lambda), sin(epsilon) * sin(lambda)
+    };
+}
+
+static double toSeconds(struct timespec ts) {
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct timespec fromSeconds(double t) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000l) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000l;
+    }
+    return ts;
+}
+
+static double clockNow(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return toSeconds(ts);
+}
+
+static void printStats(FILE* report, const LiveStats* stats) {
+    fprintf(report, "live: %lld frames, %lld dropped, late %.3f ms mean "
+        "%.3f ms max, wall clock drift %+.3f ms over %.1f s\n",
+        stats->frames, stats->dropped, stats->meanLate * 1000.0,
+        stats->maxLate * 1000.0, stats->clockDrift * 1000.0,
+        stats->elapsed);
+}
+
+void liveRun(double fps, double duration, LiveFrameFn* fn, void* arg,
+    volatile sig_atomic_t* stop, FILE* report, double reportInterval,
+    LiveStats* stats) {
+    
+    *stats = (LiveStats) { 0 };
+    double period = 1.0 / fps;
+    double steadyStart = clockNow(CLOCK_MONOTONIC);
+    double wallStart = clockNow(CLOCK_REALTIME);
+    double nextReport = reportInterval;
+    double totalLate = 0.0;
+    
+    for (long long k = 0; !*stop; k++) {
+        double due = steadyStart + k * period;
+        if (duration > 0.0 && due - steadyStart >= duration)
+            break;
+        struct timespec deadline = fromSeconds(due);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+            NULL) == EINTR && !*stop)
+            ;
+        if (*stop)
+            break;
+        
+        // The frame shows its scheduled moment on the wall clock, so the
+        // rotation stays smooth however late the frame itself runs.
+        double steady = clockNow(CLOCK_MONOTONIC);
+        double wall = clockNow(CLOCK_REALTIME);
+        if (fn(arg, wallStart + (due - steadyStart) +
+            stats->clockDrift) != 0)
+            break;
+        double done = clockNow(CLOCK_MONOTONIC);
+        
+        double late = done - due;
+        totalLate += late;
+        stats->frames++;
+        if (late > stats->maxLate) stats->maxLate = late;
+        stats->meanLate = totalLate / stats->frames;
+        stats->clockDrift = (wall - wallStart) - (steady - steadyStart);
+        stats->elapsed = done - steadyStart;
+        
+        // Skip the frame times this frame ran past.
+        long long next = (long long) floor((done - steadyStart) / period) + 1;
+        if (next > k + 1) {
+            stats->dropped += next - (k + 1);
+            k = next - 1;
+        }
+        
+        if (report && reportInterval > 0.0 &&
+            stats->elapsed >= nextReport) {
+            printStats(report, stats);
+            nextReport += reportInterval;
+        }
+    }
+    if (report)
+        printStats(report, stats);
+}
@@ -0,0 +1,45 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <signal.h>
+#include <stdio.h>
+
+#include "vec3.h"
+
+// Real-time streaming: where the Earth and the sun are at a given moment,
+// and a frame loop paced by the clock that runs until it is stopped.
+
+// Greenwich mean sidereal time at unixTime, in turns (0 to 1). Passed as
+// time with totalTime = 1, it turns the globe as the Earth is turned.
+double liveSiderealTurns(double unixTime);
+
+// Unit vector toward the sun at unixTime in equatorial coordinates of
+// date (z toward the north pole, x toward the equinox), accurate to about
+// 0.01 degrees, for globeLightFromSun().
+Vec3 liveSunDirection(double unixTime);
+
+// Render and emit the frame for unixTime. Returns 0 to keep going.
+typedef int LiveFrameFn(void* arg, double unixTime);
+
+typedef struct LiveStats {
+    long long frames;
+    // Frame times skipped because a frame ran past the next one's.
+    long long dropped;
+    // Seconds from each frame's scheduled time to when it was emitted.
+    double meanLate, maxLate;
+    // How far the wall clock moved against the steady clock over the run
+    // (NTP slewing or steps), in seconds. Frames follow the wall clock.
+    double clockDrift;
+    double elapsed;
+} LiveStats;
+
+// Call fn for a frame every 1 / fps seconds of the steady clock, sleeping
+// to each frame's time with clock_nanosleep(). A frame that runs late
+// drops the frame times it ran past instead of falling further behind.
+// Runs for duration seconds (forever if <= 0) or until *stop is set or fn
+// fails. report, if not NULL, gets stats every reportInterval seconds.
+void liveRun(double fps, double duration, LiveFrameFn* fn, void* arg,
+    volatile sig_atomic_t* stop, FILE* report, double reportInterval,
+    LiveStats* stats);
+
+#endif
@@ -1,270 +1,930 @@
-#include <math.h>
-#include <stdlib.h>
-#include <stdint.h>
-
-#include "cgif.h"
-
-#include "earth_data.h"
-
-#define PI 3.141592653589793
-#define PI_OVER_TWO 1.570796326794896
-#define TWO_PI 6.283185307179586
-#define DEG_TO_RAD 0.01745329251994329
-
-typedef struct Vec3 {
-    double x, y, z;
-} Vec3;
-
-// Sum of two vectors.
-Vec3 vsum(Vec3 a, Vec3 b) {
-    return (Vec3) { a.x + b.x, a.y + b.y, a.z + b.z };
-}
-
-// Difference of two vectors.
-Vec3 vdiff(Vec3 a, Vec3 b) {
-    return (Vec3) { a.x - b.x, a.y - b.y, a.z - b.z };
-}
-
-// Scale a vector.
-Vec3 vscl(Vec3 a, double s) {
-    return (Vec3) { s * a.x, s * a.y, s * a.z };
-}
-
-// Cartesian dot product of two vectors.
-// https://en.wikipedia.org/wiki/Dot_product
-double vdot(Vec3 a, Vec3 b) {
-    return a.x * b.x + a.y * b.y + a.z * b.z;
-}
-
-// Get magnitude squared (length squared) of a vector.
-// The dot product of a vector with itself is equivalent to the
-// pythagorean theorem.
-// https://en.wikipedia.org/wiki/Dot_product
-double vmag2(Vec3 a) {
-    return vdot(a, a);
-}
-
-// Rotate on XY plane.
-// https://en.wikipedia.org/wiki/Rotation_matrix
-Vec3 vrotxy(Vec3 v, double c, double s) {
-    return (Vec3) { v.x * c - v.y * s, v.x * s + v.y * c, v.z };
-}
-
-// Rotate on YZ plane.
-// https://en.wikipedia.org/wiki/Rotation_matrix
-Vec3 vrotyz(Vec3 v, double c, double s) {
-    return (Vec3) { v.x, v.y * c - v.z * s, v.y * s + v.z * c };
-}
-
-// Rotate on ZX plane.
-// https://en.wikipedia.org/wiki/Rotation_matrix
-Vec3 vrotzx(Vec3 v, double c, double s) {
-    return (Vec3) { v.z * s + v.x * c, v.y, v.z * c - v.x * s };
-}
-
-// Find intersection between ray and sphere.
-// https://en.wikipedia.org/wiki/Line%E2%80%93sphere_intersection
-Vec3 raySphere(Vec3 o, Vec3 u, Vec3 c, double r) {
-    // Normalize u (make it have length 1). This allows us to use the simpler
-    // Wikipedia formula at the line "Note that in the specific case where u 
-    // is a unit vector, we can simplify this further"
-    u = vscl(u, 1.0 / sqrt(vmag2(u)));
-    
-    // Initialize values according to wikipedia article.
-    Vec3 oc = vdiff(o, c);
-    double oc2 = vmag2(oc);
-    double udotoc = vdot(u, oc);
-    double udotoc2 = udotoc * udotoc;
-    double r2 = r * r;
-    
-    // On wikipedia, this variable is the upside down triangle symbol.
-    // We can just distribute the (-) and get rid of the parentheses.
-    double del = udotoc2 - oc2 + r2;
-    // del < 0.0 means no solutions
-    if (del < 0.0)
-        return (Vec3) { INFINITY, INFINITY, INFINITY };
-    // We only care about positive d, so the closer value is obtained by
-    // subtracting sqrt(del). A smaller d means a closer intersection.
-    double d = -udotoc - sqrt(del);
-    // d < 0.0 means that the ray hit the sphere "in reverse."
-    if (d < 0.0)
-        return (Vec3) { INFINITY, INFINITY, INFINITY };
-    
-    // Return origin point + direction * distance.
-    return vsum(o, vscl(u, d));
-}
-
-// Get normal given a point on a sphere.
-Vec3 sphereNormal(Vec3 c, double r, Vec3 p) {
-    return vscl(vdiff(p, c), 1.0 / r);
-}
-
-// X (U) texture coordinate given normal of sphere.
-// https://en.wikipedia.org/wiki/UV_mapping
-int texCoordX(Vec3 n, int width) {
-    double arctangent = atan2(n.x, n.z);
-    if (arctangent < 0.0) arctangent += TWO_PI;
-    
-    int x = (int) (arctangent * width / TWO_PI);
-    if (x < 0) x = 0;
-    else if (x >= width) x = width - 1;
-    
-    return x;
-}
-
-// Y (V) texture coordinate given normal of sphere.
-// https://en.wikipedia.org/wiki/UV_mapping
-int texCoordY(Vec3 n, int height) {
-    double arcsine = asin(-n.y);
-    arcsine += PI_OVER_TWO;
-    
-    int y = (int) (arcsine * height / PI);
-    if (y < 0) y = 0;
-    else if (y >= height) y = height - 1;
-    
-    return y;
-}
-
-// Render the earth.
-// time = seconds elapsed.
-// totalTime = length of whole animation in seconds.
-void traceGlobe(uint8_t* screen, int width, int height, 
-    double time, double totalTime) {
-    
-    // Field of view.
-    const double fov = 60.0;
-    // Tangent of half of fov (slope of frustum).
-    // tanFov2x and tanFov2y are 1/2 of the dimensions of the "near plane"
-    // at z = 1. We will use them to construct the view's rays.
-    double tanFov2x = tan(fov / 2.0 * DEG_TO_RAD);
-    double tanFov2y = tanFov2x * height / width;
-    double pixelSize = 2.0 * tanFov2x / width;
-    
-    // Light source direction.
-    Vec3 light = { 1.0, 0.0, -1.0 };
-    light = vscl(light, 1.0 / sqrt(vmag2(light)));
-    
-    // Center and radius of globe for raySphere() function.
-    Vec3 c = { 0.0, 0.0, 0.0 };
-    double r = 1.0;
-    
-    // Compute sine and cosine of earth's spin and axis tilt.
-    // We will complete one full rotation (2*pi).
-    double rot = -TWO_PI * time / totalTime;
-    double cRot = cos(rot);
-    double sRot = sin(rot);
-    double tilt = 23.4 * DEG_TO_RAD;
-    double cTilt = cos(tilt);
-    double sTilt = sin(tilt);
-    
-    int i = 0;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            // Origin (view/camera center) in front of globe.
-            Vec3 o = { 0.0, 0.0, 2.2 };
-            // Create ray direction vector based on near plane z = 1.
-            Vec3 u = { 
-                -tanFov2x + pixelSize * (x + 0.5), 
-                tanFov2y - pixelSize * (y - 0.5),
-                -1.0
-            };
-            // Find point where ray hits sphere and the surface normal.
-            Vec3 p = raySphere(o, u, c, r);
-            
-            // Ray hit the globe.
-            if (!isinf(p.x)) {
-                Vec3 n = sphereNormal(c, r, p);
-            
-                // Calculate brightness of point on sphere from light source.
-                double bright = -vdot(n, light);
-                int brightI = (int) (bright * 6.0);
-                if (brightI > 3) brightI = 3;
-                else if (brightI < 0) brightI = 0;
-                
-                // Rotate normals so that texture will be sampled at different
-                // locations so it appears the sphere itself is rotating.
-                n = vrotxy(n, cTilt, sTilt);
-                n = vrotzx(n, cRot, sRot);
-                
-                // Sample texture value (0 or 1, ocean or land).
-                int texX = texCoordX(n, EARTH_DATA_WIDTH);
-                int texY = texCoordY(n, EARTH_DATA_HEIGHT);
-                int sample = sampleEarthData(texX, texY);
-                
-                // Select one of four colors for ocean or one of four colors
-                // for land.
-                screen[i] = 1 + 4 * sample + brightI;
-            // Ray did not hit the globe
-            } else {
-                // Set color to background color (black).
-                screen[i] = 0;
-            }
-            
-            i++;
-        }
-    }
-}
-
-int main(int argc, char* argv[]) {
-    
-    const int width = 500;
-    const int height = 500;
-    uint8_t* screen = (uint8_t*) 
-        malloc(width * height * sizeof(uint8_t));
-        
-    const int numFrames = 200;
-    const uint16_t frameDelay = 3;
-    const int numColors = 9;
-    uint8_t palette[] = {
-        // Background color
-        0, 0, 0,
-        // Blues
-        0, 19, 88,
-        0, 24, 132,
-        0, 28, 169,
-        0, 32, 207,
-        // Greens
-        0, 82, 9,
-        8, 133, 5,
-        14, 169, 3,
-        21, 210, 0
-    };
-        
-    CGIF_Config gifConfig = {
-        .pGlobalPalette = palette,
-        .path = "globe.gif",
-        .attrFlags = CGIF_ATTR_IS_ANIMATED,
-        .genFlags = 0,
-        .width = width,
-        .height = height,
-        .numGlobalPaletteEntries = numColors,
-        .numLoops = 0,
-        .pWriteFn = NULL,
-        .pContext = NULL
-    };
-    CGIF_FrameConfig frameConfig = {
-        .pLocalPalette = NULL,
-        .pImageData = screen,
-        .attrFlags = 0,
-        .genFlags = 0,
-        .delay = frameDelay,
-        .numLocalPaletteEntries = 0,
-        .transIndex = 0
-    };
-    CGIF* gif = cgif_newgif(&gifConfig);
-    
-    double time = 0.0;
-    // Frame delay is in hundredths of a second.
-    double timeIncr = 0.01 * frameDelay;
-    double totalTime = timeIncr * numFrames;
-    for (int i = 0; i < numFrames; i++) {
-        traceGlobe(screen, width, height, time, totalTime);
-        cgif_addframe(gif, &frameConfig);
-        time = i * timeIncr;
-    }
-    
-    cgif_close(gif);
-    free(screen);
-    
-    return 0;
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cgif.h"
+
+#include "globe.h"
+#include "bench.h"
+#include "quality.h"
+#include "pool.h"
+#include "cpu_limits.h"
+#include "mmap_writer.h"
+#include "topology.h"
+#include "tile_map.h"
+#include "pipeline.h"
+#include "fanout.h"
+#include "autotune.h"
+#include "gif_edit.h"
+#include "accounting.h"
+#include "live.h"
+#include "geometry.h"
+#include "frame_store.h"
+#include "color_texture.h"
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s [--bench] [--wgs84] [--flattening f] "
+        "[--pitch degrees] [--rings] [--threads n] [--mmap] [--raw path] "
+        "[--lights] [--eclipse] "
+        "[--camera pinhole|fisheye|panoramic|orthographic] [--fov degrees] "
+        "[--placement naive|smt-pair|one-per-core] [--stats] [--tee path] "
+        "[--tcp host:port] [--memory] [--autotune] [--profile path] "
+        "[--geometry-cache] [--geometry-dir dir] [--bit-sliced] "
+        "[--cube-map] [--color] [--texture path.ppm] [--dither] [--quality] "
+        "[--account path] [--job name] [--live fps] [--duration seconds] "
+        "[--scanlines] [--scrub megabytes]\n"
+        "       %s --edit in.gif out.gif [--delay cs] "
+        "[--frames first:last[:step]] [--reverse] [--palette path]\n",
+        name, name);
+    return 1;
+}
+
+// State shared by the stages of the render pipeline in main().
+typedef struct Render {
+    Pool* pool;
+    GlobeConfig config;
+    int eclipse;
+    Vec3 toSun;
+    int width, height;
+    int numFrames;
+    double timeIncr, totalTime;
+    size_t frameSize;
+    // A frame per pipeline slot, or for raw output the whole file, which
+    // frames are traced straight into.
+    uint8_t* slotFrames;
+    uint8_t* rawFrames;
+    // Tile map per slot, and a copy of the previous frame's, whose slot may
+    // already be tracing a later frame by the time it is compared.
+    TileMap** tiles;
+    TileMap* prevTiles;
+    long long dirtyPixels;
+    CGIF* gif;
+    CGIF_FrameConfig frameConfig;
+    Fanout* fanout;
+    MmapWriter* rawOut;
+    // Job charged for the stages' CPU time, or NULL.
+    JobAccount* account;
+} Render;
+
+static uint8_t* renderFrame(const Render* render, int frame, int slot) {
+    if (render->rawFrames)
+        return render->rawFrames + frame * render->frameSize;
+    return render->slotFrames + slot * render->frameSize;
+}
+
+static void traceStage(void* arg, int frame, int slot) {
+    Render* render = (Render*) arg;
+    GlobeConfig config = render->config;
+    if (render->eclipse) {
+        // Sweep the shadow from the south to the north pole.
+        Vec3 sweep = { 0.0, -1.6 + 3.2 * frame / render->numFrames, 0.0 };
+        config.occluderCenter = vsum(vscl(render->toSun, 30.0), sweep);
+    }
+    // Each frame shows the time the previous one ended at.
+    double time = frame > 0 ? (frame - 1) * render->timeIncr : 0.0;
+    traceGlobeParallel(render->pool, renderFrame(render, frame, slot),
+        render->width, render->height, time, render->totalTime, &config,
+        render->tiles[slot]);
+}
+
+// Changed area against the previous frame, from the renderer's tile maps.
+static void diffStage(void* arg, int frame, int slot) {
+    Render* render = (Render*) arg;
+    long long start = render->account ? accountThreadNs() : 0;
+    TileMap* tiles = render->tiles[slot];
+    if (frame == 0) {
+        render->dirtyPixels += (long long) render->width * render->height;
+    } else {
+        TileRect rect = tileMapDirtyRect(render->prevTiles, tiles);
+        render->dirtyPixels += (long long) rect.width * rect.height;
+    }
+    memcpy(render->prevTiles->hash, tiles->hash,
+        tiles->tilesX * tiles->tilesY * sizeof(uint64_t));
+    if (render->account)
+        accountAdd(render->account, ACCOUNT_DIFF, start);
+}
+
+static void encodeStage(void* arg, int frame, int slot) {
+    Render* render = (Render*) arg;
+    long long start = render->account ? accountThreadNs() : 0;
+    render->frameConfig.pImageData = renderFrame(render, frame, slot);
+    cgif_addframe(render->gif, &render->frameConfig);
+    // Live sinks get each frame as soon as it is encoded.
+    if (render->fanout)
+        fanoutFlush(render->fanout);
+    if (render->account) {
+        accountAdd(render->account, ACCOUNT_ENCODE, start);
+        atomic_fetch_add(&render->account->frames, 1);
+    }
+}
+
+static void writeStage(void* arg, int frame, int slot) {
+    Render* render = (Render*) arg;
+    long long start = render->account ? accountThreadNs() : 0;
+    mmapWriterCommit(render->rawOut, render->frameSize);
+    if (render->account) {
+        accountAdd(render->account, ACCOUNT_WRITE, start);
+        atomic_fetch_add(&render->account->bytes, render->frameSize);
+    }
+}
+
+// Run frames 0 ... numFrames - 1 through the pipeline with the given
+// tuning and return the wall time. report, if not NULL, gets each stage's
+// utilization.
+static double renderRun(Render* render, int numFrames, const TuneParams* tune,
+    int encodeCpu, FILE* report) {
+    
+    int numSlots = tune->traceDepth + 2;
+    size_t frameSize = render->frameSize;
+    render->config.bandRows = tune->bandRows;
+    render->slotFrames = render->rawFrames ? NULL :
+        (uint8_t*) malloc(numSlots * frameSize);
+    render->tiles = (TileMap**) malloc(numSlots * sizeof(TileMap*));
+    for (int i = 0; i < numSlots; i++)
+        render->tiles[i] = tileMapCreate(render->width, render->height,
+            tune->tileSize);
+    render->prevTiles = tileMapCreate(render->width, render->height,
+        tune->tileSize);
+    
+    // Several frames are traced at once so the pool has the next frame's
+    // bands to start on while the last bands of a frame finish. Diffing
+    // needs the previous frame, and encoding and writing append to files,
+    // so those take the frames in order.
+    PipelineStage stages[] = {
+        { "trace", traceStage, render, tune->traceDepth, 0, -1 },
+        { "diff", diffStage, render, 1, 1, -1 },
+        { "encode", encodeStage, render, 1, 1, encodeCpu },
+        { "write", writeStage, render, 1, 1, -1 }
+    };
+    int numStages = render->rawOut ? 4 : 3;
+    PipelineStats stageStats[4];
+    double wall = pipelineRun(stages, numStages, numFrames, numSlots,
+        stageStats);
+    
+    if (report) {
+        fprintf(report, "%d frames in %.3f s (%.1f fps)\n", numFrames, wall,
+            numFrames / wall);
+        fprintf(report, "%-8s %8s %10s %12s\n", "stage", "threads",
+            "busy s", "utilization");
+        for (int i = 0; i < numStages; i++)
+            fprintf(report, "%-8s %8d %10.3f %11.0f%%\n", stages[i].name,
+                stages[i].ordered ? 1 : stages[i].concurrency,
+                stageStats[i].busy, stageStats[i].utilization * 100.0);
+        fprintf(report, "changed area: %.1f%% of pixels per frame\n",
+            100.0 * render->dirtyPixels / ((double) numFrames * frameSize));
+    }
+    
+    for (int i = 0; i < numSlots; i++)
+        tileMapFree(render->tiles[i]);
+    free(render->tiles);
+    tileMapFree(render->prevTiles);
+    free(render->slotFrames);
+    return wall;
+}
+
+// GIF output that is thrown away, for tuning trials.
+static int discardWrite(void* context, const uint8_t* data, size_t size) {
+    return 0;
+}
+
+typedef struct TuneTrial {
+    const Render* render;
+    CGIF_Config gifConfig;
+    int numFrames;
+} TuneTrial;
+
+// Time the start of the real animation, encoded but not written.
+static double renderTrial(void* arg, const TuneParams* params) {
+    TuneTrial* trial = (TuneTrial*) arg;
+    Render render = *trial->render;
+    render.pool = poolCreate(params->threads);
+    render.gif = cgif_newgif(&trial->gifConfig);
+    double wall = renderRun(&render, trial->numFrames, params, -1, NULL);
+    cgif_close(render.gif);
+    poolDestroy(render.pool);
+    return wall / trial->numFrames;
+}
+
+// State for the frames of --live. Everything is allocated up front and
+// reused for every frame.
+typedef struct LiveRender {
+    Pool* pool;
+    GlobeConfig config;
+    int width, height;
+    uint8_t* screen;
+    int fd;
+    // Write rows as they are traced (--scanlines), and the sums of each
+    // frame's time to its first and last rows.
+    int scanlines;
+    int failed;
+    double firstRow, lastRow;
+    long long frames;
+} LiveRender;
+
+static volatile sig_atomic_t liveStop = 0;
+
+static void stopLive(int signal) {
+    liveStop = 1;
+}
+
+static void liveRows(void* arg, const uint8_t* rows, int y0, int y1) {
+    LiveRender* live = (LiveRender*) arg;
+    if (!live->failed && fanoutFdWrite((void*) (intptr_t) live->fd, rows,
+        (size_t) (y1 - y0) * live->width) != 0)
+        live->failed = 1;
+}
+
+// Render the globe as it is at unixTime and write the raw frame.
+static int liveFrame(void* arg, double unixTime) {
+    LiveRender* live = (LiveRender*) arg;
+    GlobeConfig config = live->config;
+    config.light = globeLightFromSun(liveSunDirection(unixTime), &config);
+    if (live->scanlines) {
+        GlobeScanlineStats stats;
+        traceGlobeScanlines(live->pool, live->screen, live->width,
+            live->height, liveSiderealTurns(unixTime), 1.0, &config,
+            liveRows, live, &stats);
+        live->firstRow += stats.firstRow;
+        live->lastRow += stats.lastRow;
+        live->frames++;
+        return live->failed ? -1 : 0;
+    }
+    traceGlobeParallel(live->pool, live->screen, live->width, live->height,
+        liveSiderealTurns(unixTime), 1.0, &config, NULL);
+    return fanoutFdWrite((void*) (intptr_t) live->fd, live->screen,
+        (size_t) live->width * live->height);
+}
+
+// Stream raw frames of the globe as it is right now to stdout (or a TCP
+// peer) at fps frames per second until interrupted.
+static int runLive(double fps, double duration, int scanlines,
+    const char* tcpAddress, int numThreads, const GlobeConfig* config,
+    int width, int height) {
+    
+    int fd = 1;
+    if (tcpAddress) {
+        fd = fanoutConnect(tcpAddress);
+        if (fd < 0) {
+            fprintf(stderr, "cannot connect to %s\n", tcpAddress);
+            return 1;
+        }
+    }
+    CpuLimits limits;
+    cpuLimitsRead(&limits);
+    LiveRender live = {
+        poolCreate(numThreads > 0 ? numThreads : limits.threads), *config,
+        width, height, (uint8_t*) malloc((size_t) width * height), fd,
+        scanlines, 0, 0.0, 0.0, 0
+    };
+    
+    // A closed pipe or socket ends the stream like ^C does.
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopLive);
+    signal(SIGTERM, stopLive);
+    LiveStats stats;
+    liveRun(fps, duration, liveFrame, &live, &liveStop, stderr, 10.0,
+        &stats);
+    if (live.frames > 0)
+        fprintf(stderr, "rows: first written %.3f ms and last %.3f ms after "
+            "the frame started, mean of %lld frames\n",
+            live.firstRow * 1000.0 / live.frames,
+            live.lastRow * 1000.0 / live.frames, live.frames);
+    
+    if (tcpAddress)
+        close(fd);
+    free(live.screen);
+    poolDestroy(live.pool);
+    return 0;
+}
+
+// Serve frames of the rotation for scrubbing: read frame numbers from
+// stdin, one per line, and answer each with the raw frame on stdout.
+// Frames are rendered the first time they are asked for and then decoded
+// from a store of budget compressed bytes.
+static int runScrub(size_t budget, int numFrames, int numThreads,
+    const GlobeConfig* config, int width, int height) {
+    
+    CpuLimits limits;
+    cpuLimitsRead(&limits);
+    Pool* pool = poolCreate(numThreads > 0 ? numThreads : limits.threads);
+    FrameStore* store = frameStoreCreate(width, height, budget);
+    size_t frameSize = (size_t) width * height;
+    uint8_t* screen = (uint8_t*) malloc(frameSize);
+    double renderTime = 0.0, decodeTime = 0.0;
+    
+    signal(SIGPIPE, SIG_IGN);
+    char line[64];
+    while (fgets(line, sizeof(line), stdin)) {
+        char* end;
+        long frame = strtol(line, &end, 10);
+        if (end == line || frame < 0 || frame >= numFrames)
+            continue;
+        double start = benchNow();
+        if (frameStoreGet(store, (int) frame, screen)) {
+            decodeTime += benchNow() - start;
+        } else {
+            // The same picture as frame number frame of the GIF.
+            traceGlobeParallel(pool, screen, width, height,
+                frame > 0 ? frame - 1 : 0, numFrames, config, NULL);
+            renderTime += benchNow() - start;
+            frameStorePut(store, (int) frame, screen);
+        }
+        if (fanoutFdWrite((void*) (intptr_t) 1, screen, frameSize) != 0)
+            break;
+    }
+    
+    FrameStoreStats stats;
+    frameStoreStats(store, &stats);
+    fprintf(stderr, "scrub: %lld frames decoded in %.1f us each, %lld "
+        "rendered in %.3f ms each; %d frames held in %zu bytes (%.1f%% of "
+        "raw), %lld evicted\n", stats.hits, stats.hits ?
+        decodeTime * 1e6 / stats.hits : 0.0, stats.misses, stats.misses ?
+        renderTime * 1000.0 / stats.misses : 0.0, stats.frames, stats.bytes,
+        stats.frames ? 100.0 * stats.bytes / ((double) stats.frames *
+        frameSize) : 0.0, stats.evictions);
+    free(screen);
+    frameStoreFree(store);
+    poolDestroy(pool);
+    return 0;
+}
+
+// Rewrite an existing GIF's delays, palette and frame order without
+// rendering it again. frames is "first:last[:step]" or NULL for all, and
+// palettePath a text file of "r g b" lines replacing the first palette
+// entries.
+static int runEdit(const char* inPath, const char* outPath, int delay,
+    const char* frames, int reverse, const char* palettePath) {
+    
+    double start = benchNow();
+    GifFile* gif = gifOpen(inPath);
+    if (!gif) {
+        fprintf(stderr, "%s: not a readable GIF\n", inPath);
+        return 1;
+    }
+    
+    GifEdit edit = { .delay = delay };
+    int* order = NULL;
+    if (frames || reverse) {
+        int first = 0, last = gif->numFrames - 1, step = 1;
+        if (frames && sscanf(frames, "%d:%d:%d", &first, &last, &step) < 2) {
+            gifClose(gif);
+            return usage("globe");
+        }
+        if (first < 0) first = 0;
+        if (last >= gif->numFrames) last = gif->numFrames - 1;
+        if (step < 1) step = 1;
+        order = (int*) malloc(gif->numFrames * sizeof(int));
+        for (int i = first; i <= last; i += step)
+            order[edit.numOrder++] = i;
+        if (edit.numOrder == 0) {
+            fprintf(stderr, "%s: --frames selects none of its %d frames\n",
+                inPath, gif->numFrames);
+            gifClose(gif);
+            free(order);
+            return 1;
+        }
+        for (int k = 0; reverse && k < edit.numOrder / 2; k++) {
+            int t = order[k];
+            order[k] = order[edit.numOrder - 1 - k];
+            order[edit.numOrder - 1 - k] = t;
+        }
+        edit.order = order;
+    }
+    
+    uint8_t palette[256 * 3];
+    if (palettePath) {
+        FILE* file = fopen(palettePath, "r");
+        if (!file) {
+            fprintf(stderr, "%s: cannot open\n", palettePath);
+            gifClose(gif);
+            free(order);
+            return 1;
+        }
+        int r, g, b;
+        while (edit.paletteEntries < 256 &&
+            fscanf(file, "%d %d %d", &r, &g, &b) == 3) {
+            uint8_t* entry = &palette[edit.paletteEntries++ * 3];
+            entry[0] = r;
+            entry[1] = g;
+            entry[2] = b;
+        }
+        fclose(file);
+        edit.palette = palette;
+    }
+    
+    int result = gifEditWrite(gif, &edit, outPath);
+    if (result == -2)
+        fprintf(stderr, "%s: frames depend on earlier frames or the palette "
+            "is too long for this edit\n", inPath);
+    else if (result != 0)
+        fprintf(stderr, "%s: write failed\n", outPath);
+    else
+        printf("%d of %d frames written to %s in %.3f ms\n",
+            edit.order ? edit.numOrder : gif->numFrames, gif->numFrames,
+            outPath, (benchNow() - start) * 1000.0);
+    gifClose(gif);
+    free(order);
+    return result != 0;
+}
+
+int main(int argc, char* argv[]) {
+    
+    const int width = 500;
+    const int height = 500;
+    
+    GlobeConfig globeConfig = {
+        .equatorialRadius = 1.0,
+        .polarRadius = 1.0,
+        .cameraDistance = 2.2
+    };
+    int bench = 0;
+    int quality = 0;
+    int numThreads = 0;
+    int pitchSet = 0;
+    int useMmap = 0;
+    int eclipse = 0;
+    int placed = 0;
+    int stats = 0;
+    // Every --tee, globe.gif, --tcp and --memory is a fanout sink.
+    const char* tees[FANOUT_MAX_SINKS - 3];
+    int numTees = 0;
+    const char* tcpAddress = NULL;
+    int keepInMemory = 0;
+    int autotune = 0;
+    const char* profilePath = NULL;
+    const char* editIn = NULL;
+    const char* editOut = NULL;
+    int editDelay = -1;
+    const char* editFrames = NULL;
+    int editReverse = 0;
+    const char* editPalette = NULL;
+    const char* accountPath = NULL;
+    const char* jobName = "globe";
+    double liveFps = 0.0;
+    double liveDuration = 0.0;
+    int scanlines = 0;
+    double scrubMb = 0.0;
+    int color = 0;
+    const char* texturePath = NULL;
+    Placement placement = PLACEMENT_NAIVE;
+    const char* rawPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--edit") == 0 && i + 2 < argc) {
+            editIn = argv[++i];
+            editOut = argv[++i];
+        } else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc) {
+            editDelay = atoi(argv[++i]);
+            // GIF delays are 16-bit.
+            if (editDelay < 0 || editDelay > 65535)
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            editFrames = argv[++i];
+        } else if (strcmp(argv[i], "--reverse") == 0) {
+            editReverse = 1;
+        } else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+            editPalette = argv[++i];
+        } else if (strcmp(argv[i], "--account") == 0 && i + 1 < argc) {
+            accountPath = argv[++i];
+        } else if (strcmp(argv[i], "--job") == 0 && i + 1 < argc) {
+            jobName = argv[++i];
+        } else if (strcmp(argv[i], "--live") == 0 && i + 1 < argc) {
+            liveFps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            liveDuration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scrub") == 0 && i + 1 < argc) {
+            scrubMb = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scanlines") == 0) {
+            scanlines = 1;
+        } else if (strcmp(argv[i], "--quality") == 0) {
+            quality = 1;
+        } else if (strcmp(argv[i], "--wgs84") == 0) {
+            globeConfig.polarRadius = 1.0 - WGS84_FLATTENING;
+        } else if (strcmp(argv[i], "--flattening") == 0 && i + 1 < argc) {
+            double flattening = atof(argv[++i]);
+            // 1 would squash the globe to a disc, and beyond it inside out.
+            if (!(flattening >= 0.0 && flattening < 1.0))
+                return usage(argv[0]);
+            globeConfig.polarRadius = 1.0 - flattening;
+        } else if (strcmp(argv[i], "--pitch") == 0 && i + 1 < argc) {
+            globeConfig.pitch = atof(argv[++i]);
+            pitchSet = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            useMmap = 1;
+        } else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+            rawPath = argv[++i];
+        } else if (strcmp(argv[i], "--eclipse") == 0) {
+            eclipse = 1;
+        } else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "pinhole") == 0)
+                globeConfig.camera = CAMERA_PINHOLE;
+            else if (strcmp(argv[i], "fisheye") == 0)
+                globeConfig.camera = CAMERA_FISHEYE;
+            else if (strcmp(argv[i], "panoramic") == 0)
+                globeConfig.camera = CAMERA_PANORAMIC;
+            else if (strcmp(argv[i], "orthographic") == 0)
+                globeConfig.camera = CAMERA_ORTHOGRAPHIC;
+            else
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--fov") == 0 && i + 1 < argc) {
+            globeConfig.fov = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--lights") == 0) {
+            globeConfig.cityLights = 1;
+        } else if (strcmp(argv[i], "--placement") == 0 && i + 1 < argc) {
+            i++;
+            placed = 1;
+            if (strcmp(argv[i], "naive") == 0)
+                placement = PLACEMENT_NAIVE;
+            else if (strcmp(argv[i], "smt-pair") == 0)
+                placement = PLACEMENT_SMT_PAIR;
+            else if (strcmp(argv[i], "one-per-core") == 0)
+                placement = PLACEMENT_ONE_PER_CORE;
+            else
+                return usage(argv[0]);
+        } else if (strcmp(argv[i], "--tee") == 0 && i + 1 < argc &&
+            numTees < FANOUT_MAX_SINKS - 3) {
+            tees[numTees++] = argv[++i];
+        } else if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc) {
+            tcpAddress = argv[++i];
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            keepInMemory = 1;
+        } else if (strcmp(argv[i], "--geometry-cache") == 0) {
+            globeConfig.geometryCache = 1;
+        } else if (strcmp(argv[i], "--geometry-dir") == 0 && i + 1 < argc) {
+            globeConfig.geometryCache = 1;
+            globeConfig.geometryDir = argv[++i];
+        } else if (strcmp(argv[i], "--color") == 0) {
+            color = 1;
+        } else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+            texturePath = argv[++i];
+        } else if (strcmp(argv[i], "--dither") == 0) {
+            globeConfig.dither = 1;
+        } else if (strcmp(argv[i], "--cube-map") == 0) {
+            globeConfig.cubeMap = 1;
+        } else if (strcmp(argv[i], "--bit-sliced") == 0) {
+            globeConfig.bitSliced = 1;
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune = 1;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--rings") == 0) {
+            globeConfig.ringInner = 1.25;
+            globeConfig.ringOuter = 2.3;
+            globeConfig.cameraDistance = 5.0;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    
+    if (editIn)
+        return runEdit(editIn, editOut, editDelay, editFrames, editReverse,
+            editPalette);
+    
+    // Rings seen edge-on are invisible, so lean the globe toward the camera
+    // unless asked not to. The camera is also pulled back to fit them.
+    if (globeConfig.ringOuter > 0.0 && !pitchSet)
+        globeConfig.pitch = 20.0;
+    
+    // Color output: the texture, and the palette and lookup table its
+    // colors are quantized with.
+    ColorTexture* texture = NULL;
+    ColorLut* colorLut = NULL;
+    uint8_t colorPalette[COLOR_PALETTE_SIZE * 3];
+    if (color || texturePath) {
+        texture = texturePath ? colorTextureLoadPpm(texturePath) :
+            colorTextureProcedural();
+        if (!texture) {
+            fprintf(stderr, "%s: cannot read (binary PPM, maxval 255)\n",
+                texturePath);
+            return 1;
+        }
+        colorPaletteBuild(colorPalette, globePalette, GLOBE_NUM_COLORS);
+        colorLut = (ColorLut*) malloc(sizeof(ColorLut));
+        colorLutBuild(colorLut, colorPalette, GLOBE_NUM_COLORS,
+            COLOR_PALETTE_SIZE - GLOBE_NUM_COLORS);
+        globeConfig.texture = texture;
+        globeConfig.colorLut = colorLut;
+    }
+    
+    // Modes that do not write the GIF. The quality comparison uses this
+    // configuration; the eclipse is left out of all three, since its sweep
+    // is driven by the frame loop.
+    const int numFrames = 200;
+    int done = -1;
+    if (quality) {
+        runQuality(width, height, 50, numThreads, &globeConfig);
+        done = 0;
+    } else if (liveFps > 0.0) {
+        done = runLive(liveFps, liveDuration, scanlines, tcpAddress,
+            numThreads, &globeConfig, width, height);
+    } else if (scrubMb > 0.0) {
+        done = runScrub((size_t) (scrubMb * 1e6), numFrames, numThreads,
+            &globeConfig, width, height);
+    }
+    if (done >= 0) {
+        if (texture) colorTextureFree(texture);
+        free(colorLut);
+        return done;
+    }
+    
+    // A moon-sized occluder 30 earth radii toward the sun, with the sun's
+    // real angular size. Its shadow sweeps across the globe during the
+    // animation (see below).
+    Vec3 toSun = vscl(GLOBE_LIGHT, -1.0 / sqrt(vmag2(GLOBE_LIGHT)));
+    if (eclipse) {
+        globeConfig.occluderRadius = 0.273;
+        globeConfig.sunRadius = 0.266;
+    }
+    
+    if (bench) {
+        runBenchmark(width, height, 50, numThreads);
+        if (texture) colorTextureFree(texture);
+        free(colorLut);
+        return 0;
+    }
+    
+    const uint16_t frameDelay = 3;
+    const int numColors = texture ? COLOR_PALETTE_SIZE : GLOBE_NUM_COLORS;
+    uint8_t palette[COLOR_PALETTE_SIZE * 3];
+    memcpy(palette, texture ? colorPalette : globePalette, numColors * 3);
+        
+    CGIF_Config gifConfig = {
+        .pGlobalPalette = palette,
+        .path = "globe.gif",
+        .attrFlags = CGIF_ATTR_IS_ANIMATED,
+        .genFlags = 0,
+        .width = width,
+        .height = height,
+        .numGlobalPaletteEntries = numColors,
+        .numLoops = 0,
+        .pWriteFn = NULL,
+        .pContext = NULL
+    };
+    CGIF_FrameConfig frameConfig = {
+        .pLocalPalette = NULL,
+        .pImageData = NULL,
+        .attrFlags = 0,
+        .genFlags = 0,
+        .delay = frameDelay,
+        .numLocalPaletteEntries = 0,
+        .transIndex = 0
+    };
+    
+    // Frame delay is in hundredths of a second.
+    double timeIncr = 0.01 * frameDelay;
+    size_t frameSize = (size_t) width * height;
+    Render render = {
+        .config = globeConfig,
+        .eclipse = eclipse,
+        .toSun = toSun,
+        .width = width,
+        .height = height,
+        .numFrames = numFrames,
+        .timeIncr = timeIncr,
+        .totalTime = timeIncr * numFrames,
+        .frameSize = frameSize,
+        .frameConfig = frameConfig
+    };
+    
+    // Size the render pool by the CPUs the container's cgroup actually
+    // grants, not by the number the host has. The other settings come from
+    // this machine's profile for the workload, written by --autotune.
+    CpuLimits limits;
+    cpuLimitsRead(&limits);
+    TuneParams tune = tuneDefaults(limits.threads);
+    char defaultProfile[4096];
+    if (!profilePath) {
+        tuneProfilePath(defaultProfile, sizeof(defaultProfile));
+        profilePath = defaultProfile;
+    }
+    char workload[64];
+    snprintf(workload, sizeof(workload), "%dx%dx%d", width, height,
+        numFrames);
+    if (autotune) {
+        CGIF_Config trialConfig = gifConfig;
+        trialConfig.path = NULL;
+        trialConfig.pWriteFn = discardWrite;
+        TuneTrial trial = { &render, trialConfig, 24 };
+        tune = tuneSearch(renderTrial, &trial, limits.threads, stderr);
+        if (tuneSave(profilePath, workload, &tune))
+            fprintf(stderr, "saved to %s\n", profilePath);
+        else
+            fprintf(stderr, "cannot write %s\n", profilePath);
+    } else if (tuneLoad(profilePath, workload, &tune) && stats) {
+        fprintf(stderr, "using %s\n", profilePath);
+    }
+    if (numThreads > 0)
+        tune.threads = numThreads;
+    
+    Pool* pool;
+    ThreadPlacement plan = { 0, NULL, -1 };
+    if (placed) {
+        // Place the render workers and the encode stage by CPU topology.
+        CpuTopology topology;
+        cpuTopologyRead(&topology);
+        // Capped at the quota- or profile-derived count like the unplaced
+        // pool, so a CPU quota is not oversubscribed.
+        placementPlan(&topology, placement, tune.threads, &plan);
+        cpuTopologyFree(&topology);
+        pool = poolCreate(plan.numRender);
+        poolPin(pool, plan.renderCpus);
+    } else {
+        pool = poolCreate(tune.threads);
+    }
+    CpuThrottle throttleStart;
+    int throttleStats = cpuThrottleRead(&throttleStart);
+    JobAccount account;
+    if (accountPath)
+        accountStart(&account, jobName);
+    
+    // Write the GIF through a preallocated memory map instead of stdio.
+    // The size is bounded by 12-bit LZW codes for every pixel plus block
+    // overhead; the file is truncated to what was written on close.
+    MmapWriter* gifOut = NULL;
+    if (useMmap) {
+        size_t frameBound = (size_t) width * height * 3 / 2 + 
+            (size_t) width * height / 255 + 64;
+        gifOut = mmapWriterOpen(gifConfig.path, 1024 + numFrames * frameBound);
+        if (!gifOut) {
+            fprintf(stderr, "cannot map %s\n", gifConfig.path);
+            return 1;
+        }
+        gifConfig.pWriteFn = mmapWriterWrite;
+        gifConfig.pContext = gifOut;
+    }
+    
+    // Extra outputs share the one encoded stream through a fanout, with
+    // globe.gif (or its memory map) as one sink among the others. Files
+    // and the memory copy must be complete, so they hold the encoder back
+    // when they fall behind; a slow network peer is dropped instead.
+    Fanout* fanout = NULL;
+    int fds[FANOUT_MAX_SINKS];
+    int numFds = 0;
+    FanoutMemory memory = { NULL, 0, 0 };
+    if (numTees > 0 || tcpAddress || keepInMemory) {
+        const size_t maxQueued = 16 << 20;
+        fanout = fanoutCreate(64 << 10);
+        if (gifOut) {
+            fanoutAddSink(fanout, gifConfig.path, mmapWriterWrite, gifOut,
+                FANOUT_BLOCK, maxQueued);
+        }
+        for (int i = -1; i < numTees; i++) {
+            const char* path = i < 0 ? gifConfig.path : tees[i];
+            if (i < 0 && gifOut)
+                continue;
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                fprintf(stderr, "cannot open %s\n", path);
+                return 1;
+            }
+            fds[numFds++] = fd;
+            fanoutAddSink(fanout, path, fanoutFdWrite, (void*) (intptr_t) fd,
+                FANOUT_BLOCK, maxQueued);
+        }
+        if (tcpAddress) {
+            int fd = fanoutConnect(tcpAddress);
+            if (fd < 0) {
+                fprintf(stderr, "cannot connect to %s\n", tcpAddress);
+                return 1;
+            }
+            fds[numFds++] = fd;
+            fanoutAddSink(fanout, tcpAddress, fanoutFdWrite,
+                (void*) (intptr_t) fd, FANOUT_DETACH, maxQueued);
+        }
+        if (keepInMemory) {
+            fanoutAddSink(fanout, "memory", fanoutMemoryWrite, &memory,
+                FANOUT_BLOCK, maxQueued);
+        }
+        gifConfig.pWriteFn = fanoutWrite;
+        gifConfig.pContext = fanout;
+    }
+    
+    // Count the encoded bytes once, on their way out of the encoder. Writes
+    // made right there (stdio or the memory map) are part of the encode
+    // stage's CPU time; sinks on fanout threads are charged to output.
+    AccountWriter gifAccount;
+    int gifFd = -1;
+    if (accountPath) {
+        if (!gifConfig.pWriteFn) {
+            gifFd = open(gifConfig.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (gifFd < 0) {
+                fprintf(stderr, "cannot open %s\n", gifConfig.path);
+                return 1;
+            }
+            gifConfig.pWriteFn = fanoutFdWrite;
+            gifConfig.pContext = (void*) (intptr_t) gifFd;
+        }
+        gifAccount = (AccountWriter) {
+            &account, gifConfig.pWriteFn, gifConfig.pContext, 1, -1
+        };
+        gifConfig.pWriteFn = accountWrite;
+        gifConfig.pContext = &gifAccount;
+    }
+    
+    // Raw output is numFrames frames of width * height palette indices.
+    // Its size is known, so it is mapped whole and frames are traced
+    // straight into the file.
+    MmapWriter* rawOut = NULL;
+    uint8_t* rawFrames = NULL;
+    if (rawPath) {
+        rawOut = mmapWriterOpen(rawPath, numFrames * frameSize);
+        if (rawOut)
+            rawFrames = mmapWriterReserve(rawOut, numFrames * frameSize);
+        if (!rawFrames) {
+            fprintf(stderr, "cannot map %s\n", rawPath);
+            return 1;
+        }
+    }
+    
+    render.pool = pool;
+    render.gif = cgif_newgif(&gifConfig);
+    render.fanout = fanout;
+    render.rawFrames = rawFrames;
+    render.rawOut = rawOut;
+    render.account = accountPath ? &account : NULL;
+    render.config.account = render.account;
+    renderRun(&render, numFrames, &tune, plan.encodeCpu, stats ? stderr : NULL);
+    GeometryCacheStats geometryStats;
+    geometryCacheStats(&geometryStats);
+    if (stats && geometryStats.sharedHits + geometryStats.sharedMisses +
+        geometryStats.privateBuilds > 0)
+        fprintf(stderr, "geometry tables: %d shared hits in %.3f ms, "
+            "%d misses built in %.3f ms, %d private in %.3f ms\n",
+            geometryStats.sharedHits, geometryStats.hitSeconds * 1000.0,
+            geometryStats.sharedMisses, geometryStats.missSeconds * 1000.0,
+            geometryStats.privateBuilds,
+            geometryStats.privateSeconds * 1000.0);
+    cgif_close(render.gif);
+    
+    int status = 0;
+    if (fanout) {
+        FanoutSinkStats sinkStats[FANOUT_MAX_SINKS];
+        if (fanoutClose(fanout, sinkStats) != 0) {
+            fprintf(stderr, "error writing %s\n", gifConfig.path);
+            status = 1;
+        }
+        int numSinks = numFds + (gifOut ? 1 : 0) + keepInMemory;
+        for (int i = 0; accountPath && i < numSinks; i++)
+            atomic_fetch_add(&account.cpuNs[ACCOUNT_WRITE],
+                (long long) (sinkStats[i].cpu * 1e9));
+        for (int i = 0; stats && i < numSinks; i++) {
+            const FanoutSinkStats* sink = &sinkStats[i];
+            fprintf(stderr, "sink %-20s %8.2f MB %8.1f MB/s, %zu bytes "
+                "dropped, %zu max queued%s\n", sink->name,
+                sink->bytes / 1e6, sink->busy > 0.0 ?
+                sink->bytes / 1e6 / sink->busy : 0.0, sink->droppedBytes,
+                sink->maxQueued, sink->failed ? ", failed" :
+                sink->detached ? ", detached" : "");
+        }
+        for (int i = 0; i < numFds; i++)
+            close(fds[i]);
+        free(memory.data);
+    }
+    if (gifOut && mmapWriterClose(gifOut) != 0) {
+        fprintf(stderr, "error writing %s\n", gifConfig.path);
+        status = 1;
+    }
+    if (rawOut && mmapWriterClose(rawOut) != 0) {
+        fprintf(stderr, "error writing %s\n", rawPath);
+        status = 1;
+    }
+    if (gifFd >= 0)
+        close(gifFd);
+    if (accountPath) {
+        FILE* out = strcmp(accountPath, "-") == 0 ? stdout :
+            fopen(accountPath, "a");
+        if (out) {
+            accountWriteRecord(&account, out);
+            if (out != stdout) fclose(out);
+        } else {
+            fprintf(stderr, "cannot open %s\n", accountPath);
+            status = 1;
+        }
+    }
+    poolDestroy(pool);
+    placementFree(&plan);
+    if (texture) colorTextureFree(texture);
+    free(colorLut);
+    
+    CpuThrottle throttleEnd;
+    if (throttleStats && cpuThrottleRead(&throttleEnd) &&
+        throttleEnd.throttledPeriods > throttleStart.throttledPeriods) {
+        fprintf(stderr, "warning: CPU quota throttled %lld periods (%.3f s); "
+            "try fewer --threads\n",
+            throttleEnd.throttledPeriods - throttleStart.throttledPeriods,
+            throttleEnd.throttledTime - throttleStart.throttledTime);
+    }
+    
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mmap_writer.h"
+
+struct MmapWriter {
+    int fd;
+    uint8_t* map;
+    // Bytes mapped (and allocated on disk) and bytes committed.
+    size_t capacity;
+    size_t size;
+    // Set when a grow failed, so close can report it.
+    int failed;
+};
+
+// Make room for at least minCapacity bytes by doubling the file and its
+// mapping.
+static int mmapWriterGrow(MmapWriter* writer, size_t minCapacity) {
+    size_t capacity = writer->capacity ? writer->capacity : 4096;
+    while (capacity < minCapacity)
+        capacity *= 2;
+    
+    // posix_fallocate() reserves the blocks up front, so page faults on the
+    // mapping never hit a full disk (SIGBUS) and the file stays contiguous.
+    if (posix_fallocate(writer->fd, 0, capacity) != 0 &&
+        ftruncate(writer->fd, capacity) != 0)
+        return 0;
+    
+    uint8_t* map;
+    if (writer->map)
+        map = (uint8_t*) mremap(writer->map, writer->capacity, capacity,
+            MREMAP_MAYMOVE);
+    else
+        map = (uint8_t*) mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+            MAP_SHARED, writer->fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+    
+    writer->map = map;
+    writer->capacity = capacity;
+    return 1;
+}
+
+MmapWriter* mmapWriterOpen(const char* path, size_t sizeHint) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+    
+    MmapWriter* writer = (MmapWriter*) calloc(1, sizeof(MmapWriter));
+    writer->fd = fd;
+    if (!mmapWriterGrow(writer, sizeHint ? sizeHint : 1)) {
+        close(fd);
+        free(writer);
+        return NULL;
+    }
+    // Output is written once from front to back.
+    madvise(writer->map, writer->capacity, MADV_SEQUENTIAL);
+    
+    return writer;
+}
+
+uint8_t* mmapWriterReserve(MmapWriter* writer, size_t numBytes) {
+    if (writer->size + numBytes > writer->capacity &&
+        !mmapWriterGrow(writer, writer->size + numBytes)) {
+        writer->failed = 1;
+        return NULL;
+    }
+    return writer->map + writer->size;
+}
+
+void mmapWriterCommit(MmapWriter* writer, size_t numBytes) {
+    writer->size += numBytes;
+}
+
+int mmapWriterWrite(void* context, const uint8_t* data, const size_t numBytes) {
+    MmapWriter* writer = (MmapWriter*) context;
+    uint8_t* dst = mmapWriterReserve(writer, numBytes);
+    if (!dst)
+        return -1;
+    memcpy(dst, data, numBytes);
+    mmapWriterCommit(writer, numBytes);
+    return 0;
+}
+
+size_t mmapWriterSize(const MmapWriter* writer) {
+    return writer->size;
+}
+
+int mmapWriterClose(MmapWriter* writer) {
+    int ok = !writer->failed;
+    munmap(writer->map, writer->capacity);
+    // Give back the unused part of the preallocation.
+    if (ftruncate(writer->fd, writer->size) != 0)
+        ok = 0;
+    if (close(writer->fd) != 0)
+        ok = 0;
+    free(writer);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,35 @@
+#ifndef MMAP_WRITER_H
+#define MMAP_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output file written through a shared memory map instead of stdio. The
+// file is preallocated to a size hint and mapped, producers write straight
+// into the mapping, and the file is truncated to the bytes written on close.
+typedef struct MmapWriter MmapWriter;
+
+// Create (or replace) path with sizeHint bytes reserved. Returns NULL on
+// failure. Writing past the hint grows the file and remaps it.
+MmapWriter* mmapWriterOpen(const char* path, size_t sizeHint);
+
+// Pointer to the next numBytes bytes of the file, for producers that can
+// render or encode in place. Returns NULL if the file could not grow. The
+// bytes only count as written once mmapWriterCommit() is called, and the
+// pointer is invalidated by the next reserve or write.
+uint8_t* mmapWriterReserve(MmapWriter* writer, size_t numBytes);
+void mmapWriterCommit(MmapWriter* writer, size_t numBytes);
+
+// Append bytes. Matches cgif_write_fn, so a writer can be passed as
+// CGIF_Config.pContext with this as pWriteFn. Returns 0 on success and -1
+// on failure.
+int mmapWriterWrite(void* context, const uint8_t* data, const size_t numBytes);
+
+// Bytes committed so far.
+size_t mmapWriterSize(const MmapWriter* writer);
+
+// Unmap, truncate the file to its final size and close it. Returns 0 on
+// success and -1 if any write or the truncate failed.
+int mmapWriterClose(MmapWriter* writer);
+
+#endif
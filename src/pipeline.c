@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "topology.h"
+
+typedef struct PipelineRun {
+    pthread_mutex_t lock;
+    // Signalled whenever an item finishes a stage.
+    pthread_cond_t progress;
+    const PipelineStage* stages;
+    int numStages;
+    int numItems;
+    int numSlots;
+    // Stages each item has finished, and whether it is in one right now.
+    int* finished;
+    uint8_t* running;
+    // Per stage: first item that has not finished the stage yet.
+    int* first;
+    double* busy;
+} PipelineRun;
+
+typedef struct StageThread {
+    PipelineRun* run;
+    int stage;
+    pthread_t thread;
+} StageThread;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Next item that can enter stage s, or -1 if none can yet.
+static int nextItem(PipelineRun* run, int s) {
+    const PipelineStage* stage = &run->stages[s];
+    while (run->first[s] < run->numItems &&
+        run->finished[run->first[s]] > s)
+        run->first[s]++;
+    
+    // Items past first + numSlots cannot have entered the pipeline yet.
+    int end = run->first[s] + run->numSlots;
+    if (end > run->numItems) end = run->numItems;
+    for (int k = run->first[s]; k < end; k++) {
+        // A slot frees up once its previous item has left the last stage.
+        if (s == 0 && k >= run->numSlots &&
+            run->finished[k - run->numSlots] < run->numStages)
+            return -1;
+        if (run->finished[k] == s && !run->running[k])
+            return k;
+        if (stage->ordered)
+            return -1;
+    }
+    return -1;
+}
+
+static void* stageThread(void* arg) {
+    StageThread* self = (StageThread*) arg;
+    PipelineRun* run = self->run;
+    int s = self->stage;
+    const PipelineStage* stage = &run->stages[s];
+    
+    pthread_mutex_lock(&run->lock);
+    for (;;) {
+        int item = nextItem(run, s);
+        if (item < 0) {
+            if (run->first[s] >= run->numItems)
+                break;
+            pthread_cond_wait(&run->progress, &run->lock);
+            continue;
+        }
+        run->running[item] = 1;
+        pthread_mutex_unlock(&run->lock);
+        
+        double start = now();
+        stage->fn(stage->arg, item, item % run->numSlots);
+        double elapsed = now() - start;
+        
+        pthread_mutex_lock(&run->lock);
+        run->busy[s] += elapsed;
+        run->running[item] = 0;
+        run->finished[item]++;
+        pthread_cond_broadcast(&run->progress);
+    }
+    pthread_mutex_unlock(&run->lock);
+    
+    return NULL;
+}
+
+double pipelineRun(const PipelineStage* stages, int numStages, int numItems,
+    int numSlots, PipelineStats* stats) {
+    
+    if (numSlots < 1) numSlots = 1;
+    PipelineRun run = {
+        .stages = stages,
+        .numStages = numStages,
+        .numItems = numItems,
+        .numSlots = numSlots,
+        .finished = (int*) calloc(numItems, sizeof(int)),
+        .running = (uint8_t*) calloc(numItems, sizeof(uint8_t)),
+        .first = (int*) calloc(numStages, sizeof(int)),
+        .busy = (double*) calloc(numStages, sizeof(double))
+    };
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.progress, NULL);
+    
+    // Ordered stages only ever have one item to work on.
+    int* numThreads = (int*) malloc(numStages * sizeof(int));
+    int total = 0;
+    for (int s = 0; s < numStages; s++) {
+        numThreads[s] = stages[s].ordered || stages[s].concurrency < 1 ?
+            1 : stages[s].concurrency;
+        total += numThreads[s];
+    }
+    
+    double start = now();
+    StageThread* threads = (StageThread*) malloc(total * sizeof(StageThread));
+    int started = 0;
+    for (int s = 0; s < numStages; s++) {
+        for (int t = 0; t < numThreads[s]; t++) {
+            StageThread* thread = &threads[started];
+            thread->run = &run;
+            thread->stage = s;
+            if (pthread_create(&thread->thread, NULL, stageThread, thread))
+                continue;
+            cpuPinThread(thread->thread, stages[s].cpu);
+            started++;
+        }
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i].thread, NULL);
+    double wall = now() - start;
+    
+    for (int s = 0; stats && s < numStages; s++) {
+        stats[s].items = run.first[s];
+        stats[s].busy = run.busy[s];
+        stats[s].utilization = wall > 0.0 ?
+            run.busy[s] / (wall * numThreads[s]) : 0.0;
+    }
+    
+    free(threads);
+    free(numThreads);
+    pthread_cond_destroy(&run.progress);
+    pthread_mutex_destroy(&run.lock);
+    free(run.finished);
+    free(run.running);
+    free(run.first);
+    free(run.busy);
+    return wall;
+}
@@ -0,0 +1,43 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// Runs a sequence of items (frames) through a chain of stages, each on
+// threads of its own, so that one frame can be encoded while the next ones
+// are traced. Every item passes the stages in order; different items are
+// in different stages at once.
+//
+// Items in flight share a fixed set of slots: item k uses slot
+// k % numSlots and only enters the first stage once item k - numSlots has
+// left the last one, which bounds the buffers the stages need.
+
+// Stage body for one item, run on one of the stage's threads.
+typedef void PipelineFn(void* arg, int item, int slot);
+
+typedef struct PipelineStage {
+    const char* name;
+    PipelineFn* fn;
+    void* arg;
+    // Threads running this stage, each on one item at a time.
+    int concurrency;
+    // Take items strictly in order, one at a time, e.g. for a stage that
+    // depends on the previous item or appends to a file.
+    int ordered;
+    // CPU to pin the stage's threads to, or -1.
+    int cpu;
+} PipelineStage;
+
+typedef struct PipelineStats {
+    int items;
+    // Seconds spent in the stage's fn, summed over its threads.
+    double busy;
+    // busy over the time the stage's threads were available.
+    double utilization;
+} PipelineStats;
+
+// Run items 0 ... numItems - 1 through the stages and wait for all of them
+// to finish. stats (numStages entries) may be NULL. Returns the wall time
+// in seconds.
+double pipelineRun(const PipelineStage* stages, int numStages, int numItems,
+    int numSlots, PipelineStats* stats);
+
+#endif
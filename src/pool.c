@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "topology.h"
+
+// A poolFor() call, which lives on the caller's stack until it is finished,
+// or a poolSubmit() call, which is allocated and freed by the last worker.
+typedef struct PoolBatch {
+    PoolFn* fn;
+    void* arg;
+    PoolDoneFn* done;
+    int submitted;
+    int count;
+    // Next index to hand out and number of indices not yet finished.
+    int next;
+    int remaining;
+    struct PoolBatch* nextBatch;
+} PoolBatch;
+
+struct Pool {
+    pthread_mutex_t lock;
+    // Signalled when a batch is queued or the pool is shutting down.
+    pthread_cond_t work;
+    // Signalled when a batch finishes.
+    pthread_cond_t done;
+    // Batches with indices left to hand out, oldest first.
+    PoolBatch* head;
+    PoolBatch* tail;
+    pthread_t* threads;
+    int numThreads;
+    int quit;
+};
+
+static void* poolWorker(void* arg) {
+    Pool* pool = (Pool*) arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->quit)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (!pool->head)
+            break;
+        
+        // Claim the next index of the batch at the head. The batch then
+        // leaves the queue if that was its last index, or moves to the back
+        // so that concurrent batches take turns.
+        PoolBatch* batch = pool->head;
+        int index = batch->next++;
+        pool->head = batch->nextBatch;
+        if (!pool->head) pool->tail = NULL;
+        if (batch->next < batch->count) {
+            batch->nextBatch = NULL;
+            if (pool->tail) pool->tail->nextBatch = batch;
+            else pool->head = batch;
+            pool->tail = batch;
+        }
+        
+        pthread_mutex_unlock(&pool->lock);
+        batch->fn(batch->arg, index);
+        pthread_mutex_lock(&pool->lock);
+        
+        if (--batch->remaining == 0) {
+            if (batch->submitted) {
+                pthread_mutex_unlock(&pool->lock);
+                if (batch->done) batch->done(batch->arg);
+                free(batch);
+                pthread_mutex_lock(&pool->lock);
+            } else {
+                pthread_cond_broadcast(&pool->done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return NULL;
+}
+
+Pool* poolCreate(int numThreads) {
+    if (numThreads < 1) numThreads = 1;
+    
+    Pool* pool = (Pool*) calloc(1, sizeof(Pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->threads = (pthread_t*) malloc(numThreads * sizeof(pthread_t));
+    for (int i = 0; i < numThreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, poolWorker, pool) != 0)
+            break;
+        pool->numThreads++;
+    }
+    
+    return pool;
+}
+
+void poolDestroy(Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->numThreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int poolSize(const Pool* pool) {
+    return pool->numThreads;
+}
+
+int poolPin(Pool* pool, const int* cpus) {
+    int pinned = 0;
+    for (int i = 0; i < pool->numThreads; i++)
+        pinned += cpus[i] >= 0 && cpuPinThread(pool->threads[i], cpus[i]);
+    return pinned;
+}
+
+void poolFor(Pool* pool, PoolFn* fn, void* arg, int count) {
+    if (count <= 0)
+        return;
+    
+    PoolBatch batch = { fn, arg, NULL, 0, count, 0, count, NULL };
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->nextBatch = &batch;
+    else pool->head = &batch;
+    pool->tail = &batch;
+    pthread_cond_broadcast(&pool->work);
+    
+    while (batch.remaining > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void poolSubmit(Pool* pool, PoolFn* fn, void* arg, int count,
+    PoolDoneFn* done) {
+    
+    if (count <= 0) {
+        if (done) done(arg);
+        return;
+    }
+    
+    PoolBatch* batch = (PoolBatch*) malloc(sizeof(PoolBatch));
+    *batch = (PoolBatch) { fn, arg, done, 1, count, 0, count, NULL };
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->nextBatch = batch;
+    else pool->head = batch;
+    pool->tail = batch;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,35 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Fixed-size pool of worker threads running indexed tasks.
+typedef struct Pool Pool;
+
+// Task body. index runs from 0 to count - 1 for the batch it belongs to.
+typedef void PoolFn(void* arg, int index);
+
+// Start numThreads workers (at least one).
+Pool* poolCreate(int numThreads);
+// Stop the workers and free the pool. Queued batches are finished first.
+void poolDestroy(Pool* pool);
+int poolSize(const Pool* pool);
+
+// Pin worker i to CPU cpus[i] (see cpuPinThread()). Returns the number of
+// workers pinned.
+int poolPin(Pool* pool, const int* cpus);
+
+// Called once every index of a submitted batch has returned.
+typedef void PoolDoneFn(void* arg);
+
+// Run fn(arg, 0) ... fn(arg, count - 1) on the workers and wait for all of
+// them to return. Indices are handed out in order, one at a time, so
+// uneven tasks balance out.
+void poolFor(Pool* pool, PoolFn* fn, void* arg, int count);
+
+// Like poolFor() but returns immediately. done(arg) runs on the worker that
+// finishes the last index (or right away if count <= 0). Workers take one
+// index from each queued batch in turn, so concurrent batches share the
+// pool instead of running one after another.
+void poolSubmit(Pool* pool, PoolFn* fn, void* arg, int count,
+    PoolDoneFn* done);
+
+#endif
@@ -0,0 +1,252 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "quality.h"
+#include "bench.h"
+#include "pool.h"
+#include "cpu_limits.h"
+
+// Color difference people start to notice.
+#define JUST_NOTICEABLE_DELTA_E 2.3
+
+typedef enum QualityRegion {
+    // Globe pixels next to the background or the rings.
+    REGION_LIMB,
+    // Land next to ocean, and ocean next to land.
+    REGION_COAST,
+    // Night next to day, and day next to night.
+    REGION_TERMINATOR,
+    NUM_REGIONS
+} QualityRegion;
+
+typedef struct QualityMode {
+    const char* name;
+    GlobeTrig trig;
+    int floatRays;
+    int geometryCache;
+    int cubeMap;
+} QualityMode;
+
+typedef struct QualityStats {
+    long long pixels;
+    long long mismatched;
+    long long regionPixels[NUM_REGIONS];
+    long long regionMismatched[NUM_REGIONS];
+    // Sum of the color difference over all pixels, and the pixels where it
+    // is noticeable.
+    double deltaE;
+    long long noticeable;
+    double seconds;
+} QualityStats;
+
+// Color frames (GlobeConfig.texture) use palette entries from
+// GLOBE_NUM_COLORS up for the globe. Which of those are land or night is
+// not recorded, so it is guessed from the color: blue-dominant is ocean,
+// and night is as dark as the renderer's night-side shading makes texels.
+static int isTextureColor(uint8_t c) {
+    return c >= GLOBE_NUM_COLORS;
+}
+
+static int isGlobe(uint8_t c) {
+    return (c >= 1 && c <= 8) || c == GLOBE_LIGHTS_COLOR ||
+        isTextureColor(c);
+}
+
+static int isLand(const uint8_t* palette, uint8_t c) {
+    if (isTextureColor(c)) {
+        const uint8_t* rgb = &palette[c * 3];
+        return rgb[2] <= rgb[0] || rgb[2] <= rgb[1];
+    }
+    return (c >= 5 && c <= 8) || c == GLOBE_LIGHTS_COLOR;
+}
+
+// Brightness level 0 (night) to 3 of a globe color.
+static int level(const uint8_t* palette, uint8_t c) {
+    if (isTextureColor(c)) {
+        const uint8_t* rgb = &palette[c * 3];
+        int luma = (2 * rgb[0] + 5 * rgb[1] + rgb[2]) / 8;
+        return luma < 48 ? 0 : luma < 96 ? 1 : luma < 160 ? 2 : 3;
+    }
+    return c == GLOBE_LIGHTS_COLOR ? 0 : (c - 1) & 3;
+}
+
+// Bit mask of the regions pixel (x, y) of the reference frame is in, by
+// comparing it with its four neighbors.
+static int classify(const uint8_t* palette, const uint8_t* frame,
+    int width, int height, int x, int y) {
+    
+    uint8_t c = frame[y * width + x];
+    if (!isGlobe(c))
+        return 0;
+    const int dx[4] = { -1, 1, 0, 0 };
+    const int dy[4] = { 0, 0, -1, 1 };
+    int regions = 0;
+    for (int k = 0; k < 4; k++) {
+        int nx = x + dx[k], ny = y + dy[k];
+        if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+            continue;
+        uint8_t d = frame[ny * width + nx];
+        if (!isGlobe(d)) {
+            regions |= 1 << REGION_LIMB;
+            continue;
+        }
+        if (isLand(palette, c) != isLand(palette, d))
+            regions |= 1 << REGION_COAST;
+        if ((level(palette, c) == 0) != (level(palette, d) == 0))
+            regions |= 1 << REGION_TERMINATOR;
+    }
+    return regions;
+}
+
+// sRGB component to linear light.
+static double linearize(uint8_t v) {
+    double c = v / 255.0;
+    return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double labF(double t) {
+    return t > 216.0 / 24389.0 ? cbrt(t) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+}
+
+// CIELAB (D65 white) of a palette entry.
+static void paletteLab(const uint8_t* palette, int index, double* lab) {
+    const uint8_t* rgb = &palette[index * 3];
+    double r = linearize(rgb[0]), g = linearize(rgb[1]), b = linearize(rgb[2]);
+    double x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.95047;
+    double y = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+    double z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.08883;
+    double fx = labF(x), fy = labF(y), fz = labF(z);
+    lab[0] = 116.0 * fy - 16.0;
+    lab[1] = 500.0 * (fx - fy);
+    lab[2] = 200.0 * (fy - fz);
+}
+
+// Accumulate the differences between a reference frame and a candidate.
+// deltaE holds the difference of every pair of the numColors entries of
+// palette.
+static void compareFrame(const uint8_t* ref, const uint8_t* frame,
+    int width, int height, const uint8_t* palette, int numColors,
+    const double* deltaE, QualityStats* stats) {
+    
+    int i = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++, i++) {
+            int regions = classify(palette, ref, width, height, x, y);
+            int differs = ref[i] != frame[i];
+            for (int k = 0; k < NUM_REGIONS; k++) {
+                if (regions & (1 << k)) {
+                    stats->regionPixels[k]++;
+                    stats->regionMismatched[k] += differs;
+                }
+            }
+            stats->mismatched += differs;
+            if (differs) {
+                double d = deltaE[ref[i] * numColors + frame[i]];
+                stats->deltaE += d;
+                stats->noticeable += d > JUST_NOTICEABLE_DELTA_E;
+            }
+        }
+    }
+    stats->pixels += (long long) width * height;
+}
+
+static double percent(long long part, long long whole) {
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+void runQuality(int width, int height, int numFrames, int numThreads,
+    const GlobeConfig* config) {
+    
+    const QualityMode modes[] = {
+        { "reference (double, libm)", GLOBE_TRIG_LIBM, 0, 0, 0 },
+        { "polynomial trig", GLOBE_TRIG_POLY, 0, 0, 0 },
+        { "table trig", GLOBE_TRIG_TABLE, 0, 0, 0 },
+        { "float rays", GLOBE_TRIG_LIBM, 1, 0, 0 },
+        { "float rays + poly trig", GLOBE_TRIG_POLY, 1, 0, 0 },
+        { "float normals (cache)", GLOBE_TRIG_LIBM, 0, 1, 0 },
+        { "cache + poly trig", GLOBE_TRIG_POLY, 0, 1, 0 },
+        { "cache + table trig", GLOBE_TRIG_TABLE, 0, 1, 0 },
+        { "cube map", GLOBE_TRIG_LIBM, 0, 0, 1 },
+        { "cache + cube map", GLOBE_TRIG_LIBM, 0, 1, 1 }
+    };
+    int numModes = sizeof(modes) / sizeof(modes[0]);
+    
+    // Color frames index the color palette the lookup table was built for.
+    const uint8_t* palette = config->texture ? config->colorLut->palette :
+        globePalette;
+    int numColors = config->texture ? COLOR_PALETTE_SIZE : GLOBE_NUM_COLORS;
+    double* deltaE = (double*) malloc(numColors * numColors * sizeof(double));
+    for (int a = 0; a < numColors; a++) {
+        for (int b = 0; b < numColors; b++) {
+            double labA[3], labB[3];
+            paletteLab(palette, a, labA);
+            paletteLab(palette, b, labB);
+            deltaE[a * numColors + b] = sqrt(
+                (labA[0] - labB[0]) * (labA[0] - labB[0]) +
+                (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+                (labA[2] - labB[2]) * (labA[2] - labB[2]));
+        }
+    }
+    
+    CpuLimits limits;
+    cpuLimitsRead(&limits);
+    if (numThreads < 1) numThreads = limits.threads;
+    Pool* pool = poolCreate(numThreads);
+    
+    size_t frameSize = (size_t) width * height;
+    uint8_t* reference = (uint8_t*) malloc(frameSize * numFrames);
+    uint8_t* frame = (uint8_t*) malloc(frameSize);
+    
+    printf("%dx%d, %d frames, %d threads\n", width, height, numFrames,
+        poolSize(pool));
+    printf("%-26s %9s %8s %9s %7s %7s %7s %8s %7s\n", "mode", "ms/frame",
+        "speedup", "mismatch", "limb", "coast", "termin.", "mean dE", ">JND");
+    
+    double base = 0.0;
+    for (int m = 0; m < numModes; m++) {
+        GlobeConfig modeConfig = *config;
+        modeConfig.trig = modes[m].trig;
+        modeConfig.floatRays = modes[m].floatRays;
+        modeConfig.geometryCache = modes[m].geometryCache;
+        modeConfig.cubeMap = modes[m].cubeMap;
+        
+        // One untimed frame builds any tables the mode uses.
+        traceGlobeParallel(pool, frame, width, height, 0, numFrames,
+            &modeConfig, NULL);
+        QualityStats stats = { 0 };
+        for (int i = 0; i < numFrames; i++) {
+            // The reference mode renders straight into the reference.
+            uint8_t* out = m == 0 ? reference + i * frameSize : frame;
+            double start = benchNow();
+            traceGlobeParallel(pool, out, width, height, i, numFrames,
+                &modeConfig, NULL);
+            stats.seconds += benchNow() - start;
+            compareFrame(reference + i * frameSize, out, width, height,
+                palette, numColors, deltaE, &stats);
+        }
+        
+        double ms = stats.seconds * 1000.0 / numFrames;
+        if (m == 0) base = ms;
+        printf("%-26s %9.3f %7.2fx %8.4f%% %6.3f%% %6.3f%% %6.3f%% %8.4f "
+            "%6.4f%%\n", modes[m].name, ms, base / ms,
+            percent(stats.mismatched, stats.pixels),
+            percent(stats.regionMismatched[REGION_LIMB],
+                stats.regionPixels[REGION_LIMB]),
+            percent(stats.regionMismatched[REGION_COAST],
+                stats.regionPixels[REGION_COAST]),
+            percent(stats.regionMismatched[REGION_TERMINATOR],
+                stats.regionPixels[REGION_TERMINATOR]),
+            stats.deltaE / stats.pixels,
+            percent(stats.noticeable, stats.pixels));
+    }
+    printf("mismatch: palette indices that differ from the reference, over "
+        "the frame and\nwithin each region of the reference; dE: CIE76 "
+        "difference of the RGB frames\n");
+    
+    free(deltaE);
+    free(frame);
+    free(reference);
+    poolDestroy(pool);
+}
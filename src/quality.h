@@ -0,0 +1,16 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include "globe.h"
+
+// Render numFrames frames of one rotation with config as the reference,
+// then again with each approximate mode (GlobeConfig's trig, floatRays,
+// geometryCache and cubeMap) layered on top, and print one table to stdout: each
+// mode's speedup, the share of palette indices that differ from the
+// reference overall and at the limb, coastlines and terminator, and the
+// CIE76 color difference of the RGB-expanded frames. numThreads < 1 sizes
+// the pool from the CPU limits.
+void runQuality(int width, int height, int numFrames, int numThreads,
+    const GlobeConfig* config);
+
+#endif
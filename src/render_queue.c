@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "render_queue.h"
+
+struct RenderQueue {
+    Pool* pool;
+    // Counts completed jobs not yet taken off the queue. EFD_SEMAPHORE makes
+    // every read take exactly one.
+    int eventFd;
+    pthread_mutex_t lock;
+    // Completed jobs, oldest first.
+    RenderJob* head;
+    RenderJob* tail;
+};
+
+struct RenderJob {
+    RenderQueue* queue;
+    RenderRequest request;
+    int numBands;
+    // Per-frame constants, set up by the first band of each frame to run
+    // and shared by the rest. Guarded by setupLock.
+    TraceSetup** setups;
+    pthread_mutex_t setupLock;
+    atomic_int cancelled;
+    // Bands skipped because of cancellation.
+    atomic_int skipped;
+    // Guarded by the queue's lock.
+    RenderStatus status;
+    RenderJob* next;
+};
+
+RenderQueue* renderQueueCreate(Pool* pool) {
+    int fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    
+    RenderQueue* queue = (RenderQueue*) calloc(1, sizeof(RenderQueue));
+    queue->pool = pool;
+    queue->eventFd = fd;
+    pthread_mutex_init(&queue->lock, NULL);
+    return queue;
+}
+
+void renderQueueDestroy(RenderQueue* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    close(queue->eventFd);
+    free(queue);
+}
+
+int renderQueueFd(const RenderQueue* queue) {
+    return queue->eventFd;
+}
+
+// Pool task: one band of one frame. Cancellation is checked per band.
+static void renderJobBand(void* arg, int index) {
+    RenderJob* job = (RenderJob*) arg;
+    if (atomic_load_explicit(&job->cancelled, memory_order_relaxed)) {
+        atomic_fetch_add(&job->skipped, 1);
+        return;
+    }
+    
+    const RenderRequest* r = &job->request;
+    int frame = index / job->numBands;
+    pthread_mutex_lock(&job->setupLock);
+    if (!job->setups[frame])
+        job->setups[frame] = traceSetupCreate(r->width, r->height,
+            r->time + frame * r->timeStep, r->totalTime, &r->config);
+    const TraceSetup* setup = job->setups[frame];
+    pthread_mutex_unlock(&job->setupLock);
+    
+    int bandRows = globeBandRows(&r->config);
+    int y0 = (index % job->numBands) * bandRows;
+    int y1 = y0 + bandRows;
+    if (y1 > r->height) y1 = r->height;
+    traceSetupRows(setup, r->frames + (size_t) frame * r->width * r->height,
+        y0, y1);
+}
+
+// Pool completion: move the job to the completion queue and signal it.
+static void renderJobDone(void* arg) {
+    RenderJob* job = (RenderJob*) arg;
+    RenderQueue* queue = job->queue;
+    for (int i = 0; i < job->request.numFrames; i++)
+        if (job->setups[i])
+            traceSetupFree(job->setups[i]);
+    free(job->setups);
+    job->setups = NULL;
+    
+    pthread_mutex_lock(&queue->lock);
+    job->status = atomic_load(&job->skipped) ? RENDER_CANCELLED : RENDER_DONE;
+    if (queue->tail) queue->tail->next = job;
+    else queue->head = job;
+    queue->tail = job;
+    pthread_mutex_unlock(&queue->lock);
+    
+    uint64_t one = 1;
+    ssize_t n = write(queue->eventFd, &one, sizeof(one));
+    (void) n;
+}
+
+RenderJob* renderSubmit(RenderQueue* queue, const RenderRequest* request) {
+    RenderJob* job = (RenderJob*) calloc(1, sizeof(RenderJob));
+    job->queue = queue;
+    job->request = *request;
+    int bandRows = globeBandRows(&request->config);
+    job->numBands = (request->height + bandRows - 1) / bandRows;
+    job->setups = (TraceSetup**) calloc(request->numFrames,
+        sizeof(TraceSetup*));
+    pthread_mutex_init(&job->setupLock, NULL);
+    job->status = RENDER_PENDING;
+    
+    poolSubmit(queue->pool, renderJobBand, job,
+        request->numFrames * job->numBands, renderJobDone);
+    return job;
+}
+
+void renderCancel(RenderJob* job) {
+    atomic_store(&job->cancelled, 1);
+}
+
+RenderJob* renderQueuePoll(RenderQueue* queue) {
+    // Every queued job was counted on the eventfd before this read can
+    // succeed, so a successful read guarantees a job in the list.
+    uint64_t count;
+    if (read(queue->eventFd, &count, sizeof(count)) != sizeof(count))
+        return NULL;
+    
+    pthread_mutex_lock(&queue->lock);
+    RenderJob* job = queue->head;
+    queue->head = job->next;
+    if (!queue->head) queue->tail = NULL;
+    job->next = NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+RenderJob* renderQueueWait(RenderQueue* queue) {
+    for (;;) {
+        RenderJob* job = renderQueuePoll(queue);
+        if (job)
+            return job;
+        struct pollfd pfd = { queue->eventFd, POLLIN, 0 };
+        poll(&pfd, 1, -1);
+    }
+}
+
+RenderStatus renderJobStatus(const RenderJob* job) {
+    pthread_mutex_lock(&job->queue->lock);
+    RenderStatus status = job->status;
+    pthread_mutex_unlock(&job->queue->lock);
+    return status;
+}
+
+void* renderJobUserData(const RenderJob* job) {
+    return job->request.userData;
+}
+
+void renderJobFree(RenderJob* job) {
+    pthread_mutex_destroy(&job->setupLock);
+    free(job);
+}
@@ -0,0 +1,64 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdint.h>
+
+#include "globe.h"
+#include "pool.h"
+
+// Non-blocking rendering for event loops. Jobs are submitted to a queue,
+// rendered band by band on a shared pool, and handed back through a
+// completion queue whose eventfd becomes readable when a job finishes.
+typedef struct RenderQueue RenderQueue;
+typedef struct RenderJob RenderJob;
+
+typedef struct RenderRequest {
+    // Destination for numFrames frames of width * height palette indices,
+    // one after another. Must stay valid until the job completes.
+    uint8_t* frames;
+    int width;
+    int height;
+    int numFrames;
+    // Frame k is rendered at time + k * timeStep of a totalTime rotation.
+    double time;
+    double timeStep;
+    double totalTime;
+    GlobeConfig config;
+    // Passed back untouched by renderJobUserData().
+    void* userData;
+} RenderRequest;
+
+typedef enum RenderStatus {
+    RENDER_PENDING,
+    RENDER_DONE,
+    RENDER_CANCELLED
+} RenderStatus;
+
+// The queue does not own pool, which may be shared with other queues.
+// Returns NULL if the eventfd could not be created.
+RenderQueue* renderQueueCreate(Pool* pool);
+// All jobs must have completed and been taken off the queue.
+void renderQueueDestroy(RenderQueue* queue);
+
+// File descriptor that polls readable while completed jobs are waiting in
+// the queue, for use with epoll/poll/select.
+int renderQueueFd(const RenderQueue* queue);
+
+// Start rendering a copy of request. Returns at once with the job's handle.
+RenderJob* renderSubmit(RenderQueue* queue, const RenderRequest* request);
+
+// Ask a job to stop. Bands already running finish, the rest are skipped,
+// and the job still completes through the queue as RENDER_CANCELLED.
+void renderCancel(RenderJob* job);
+
+// Take the next completed job off the queue: NULL at once if there is none
+// (renderQueuePoll) or after blocking for one (renderQueueWait).
+RenderJob* renderQueuePoll(RenderQueue* queue);
+RenderJob* renderQueueWait(RenderQueue* queue);
+
+RenderStatus renderJobStatus(const RenderJob* job);
+void* renderJobUserData(const RenderJob* job);
+// Free a job taken off the queue.
+void renderJobFree(RenderJob* job);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shade.h"
+
+ShadePlanes* shadePlanesCreate(int width) {
+    ShadePlanes* planes = (ShadePlanes*) malloc(sizeof(ShadePlanes));
+    int numWords = (width + 63) / 64;
+    uint64_t* words = (uint64_t*) calloc(5 * numWords, sizeof(uint64_t));
+    *planes = (ShadePlanes) {
+        width, numWords,
+        words, words + numWords, words + 2 * numWords,
+        words + 3 * numWords, words + 4 * numWords
+    };
+    return planes;
+}
+
+void shadePlanesFree(ShadePlanes* planes) {
+    free(planes->hit);
+    free(planes);
+}
+
+void shadeClear(ShadePlanes* planes) {
+    // The planes are one allocation, starting at hit.
+    memset(planes->hit, 0, 5 * planes->numWords * sizeof(uint64_t));
+}
+
+static inline int bitAt(const uint64_t* plane, int x) {
+    return (plane[x >> 6] >> (x & 63)) & 1;
+}
+
+// One pixel, for the row's tail.
+static inline void expandPixel(const ShadePlanes* planes, int x,
+    uint8_t* out) {
+    
+    if (bitAt(planes->keep, x))
+        return;
+    out[x] = bitAt(planes->hit, x) ? 1 + 4 * bitAt(planes->land, x) +
+        2 * bitAt(planes->bright1, x) + bitAt(planes->bright0, x) : 0;
+}
+
+#if defined(__SSE2__)
+
+// 0xff in byte j where bit j of bits is set, for 16 bits.
+static inline __m128i spreadBits(unsigned bits) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const __m128i select = _mm_set1_epi64x(0x8040201008040201ull);
+    __m128i v = _mm_set_epi64x((long long) (((bits >> 8) & 0xff) * ones),
+        (long long) ((bits & 0xff) * ones));
+    return _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+}
+
+void shadeExpand(const ShadePlanes* planes, uint8_t* out) {
+    int width = planes->width;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        int w = x >> 6, shift = x & 63;
+        __m128i hit = spreadBits(planes->hit[w] >> shift);
+        __m128i land = spreadBits(planes->land[w] >> shift);
+        __m128i b0 = spreadBits(planes->bright0[w] >> shift);
+        __m128i b1 = spreadBits(planes->bright1[w] >> shift);
+        __m128i keep = spreadBits(planes->keep[w] >> shift);
+        
+        // 1 + 4 * land + 2 * b1 + b0, the terms' bits never overlap.
+        __m128i index = _mm_or_si128(
+            _mm_and_si128(land, _mm_set1_epi8(4)),
+            _mm_or_si128(_mm_and_si128(b1, _mm_set1_epi8(2)),
+                _mm_and_si128(b0, _mm_set1_epi8(1))));
+        index = _mm_and_si128(_mm_add_epi8(index, _mm_set1_epi8(1)), hit);
+        
+        __m128i* p = (__m128i*) (out + x);
+        __m128i old = _mm_loadu_si128(p);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, old),
+            _mm_andnot_si128(keep, index)));
+    }
+    for (; x < width; x++)
+        expandPixel(planes, x, out);
+}
+
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// 0x01 in byte j where bit j of bits is set, for 8 bits. The multiply
+// copies bits into every byte, the mask keeps bit j of byte j, and adding
+// 0x7f moves any set bit to the byte's top without carrying.
+static inline uint64_t spreadBits(unsigned bits) {
+    uint64_t v = ((bits & 0xff) * 0x0101010101010101ull) &
+        0x8040201008040201ull;
+    return ((v + 0x7f7f7f7f7f7f7f7full) & 0x8080808080808080ull) >> 7;
+}
+
+void shadeExpand(const ShadePlanes* planes, uint8_t* out) {
+    int width = planes->width;
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int w = x >> 6, shift = x & 63;
+        uint64_t hit = spreadBits(planes->hit[w] >> shift) * 0xff;
+        uint64_t keep = spreadBits(planes->keep[w] >> shift) * 0xff;
+        uint64_t index = 0x0101010101010101ull +
+            (spreadBits(planes->land[w] >> shift) << 2) +
+            (spreadBits(planes->bright1[w] >> shift) << 1) +
+            spreadBits(planes->bright0[w] >> shift);
+        
+        uint64_t old;
+        memcpy(&old, out + x, 8);
+        uint64_t word = (old & keep) | (index & hit & ~keep);
+        memcpy(out + x, &word, 8);
+    }
+    for (; x < width; x++)
+        expandPixel(planes, x, out);
+}
+
+#else
+
+void shadeExpand(const ShadePlanes* planes, uint8_t* out) {
+    for (int x = 0; x < planes->width; x++)
+        expandPixel(planes, x, out);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SHADE_H
+#define SHADE_H
+
+#include <stdint.h>
+
+// Bit-sliced shading of one row of pixels. The renderer only decides a
+// few bits per pixel (hit, land, two brightness bits), so instead of
+// composing each palette index with branches it sets bits in one word per
+// 64 pixels per plane, and shadeExpand() builds all the indices at the end
+// of the row with word-wide logic and SIMD.
+typedef struct ShadePlanes {
+    int width;
+    // Words per plane, (width + 63) / 64.
+    int numWords;
+    // Ray hit the globe.
+    uint64_t* hit;
+    // Land rather than ocean.
+    uint64_t* land;
+    // Brightness level 0-3, low and high bit.
+    uint64_t* bright0;
+    uint64_t* bright1;
+    // Pixel already holds its final color (rings, city lights), which
+    // shadeExpand() leaves alone.
+    uint64_t* keep;
+} ShadePlanes;
+
+ShadePlanes* shadePlanesCreate(int width);
+void shadePlanesFree(ShadePlanes* planes);
+
+// Zero every plane before a row.
+void shadeClear(ShadePlanes* planes);
+
+static inline void shadeSet(uint64_t* plane, int x, int bit) {
+    plane[x >> 6] |= (uint64_t) bit << (x & 63);
+}
+
+// Write the row's palette indices to out: 0 for background,
+// 1 + 4 * land + brightness for the globe, and out's current value where
+// keep is set. Background and brightness bits outside hit are ignored.
+void shadeExpand(const ShadePlanes* planes, uint8_t* out);
+
+#endif
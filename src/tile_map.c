@@ -0,0 +1,71 @@
+#include <stdlib.h>
+
+#include "tile_map.h"
+
+TileMap* tileMapCreate(int width, int height, int tileSize) {
+    TileMap* tiles = (TileMap*) malloc(sizeof(TileMap));
+    tiles->width = width;
+    tiles->height = height;
+    tiles->tileSize = tileSize;
+    tiles->tilesX = (width + tileSize - 1) / tileSize;
+    tiles->tilesY = (height + tileSize - 1) / tileSize;
+    tiles->hash = (uint64_t*) calloc(tiles->tilesX * tiles->tilesY,
+        sizeof(uint64_t));
+    tiles->rowHash = (uint64_t*) calloc(height * tiles->tilesX,
+        sizeof(uint64_t));
+    return tiles;
+}
+
+void tileMapFree(TileMap* tiles) {
+    free(tiles->rowHash);
+    free(tiles->hash);
+    free(tiles);
+}
+
+void tileMapFinish(TileMap* tiles) {
+    for (int ty = 0; ty < tiles->tilesY; ty++) {
+        int y0 = ty * tiles->tileSize;
+        int y1 = y0 + tiles->tileSize;
+        if (y1 > tiles->height) y1 = tiles->height;
+        for (int tx = 0; tx < tiles->tilesX; tx++) {
+            uint64_t h = TILE_HASH_OFFSET;
+            for (int y = y0; y < y1; y++)
+                h = (h ^ tiles->rowHash[y * tiles->tilesX + tx]) *
+                    TILE_HASH_PRIME;
+            tiles->hash[ty * tiles->tilesX + tx] = h;
+        }
+    }
+}
+
+int tileMapDiff(const TileMap* prev, const TileMap* cur, uint8_t* dirty) {
+    int numDirty = 0;
+    int numTiles = cur->tilesX * cur->tilesY;
+    for (int k = 0; k < numTiles; k++) {
+        int changed = prev->hash[k] != cur->hash[k];
+        if (dirty) dirty[k] = changed;
+        numDirty += changed;
+    }
+    return numDirty;
+}
+
+TileRect tileMapDirtyRect(const TileMap* prev, const TileMap* cur) {
+    int tx0 = cur->tilesX, ty0 = cur->tilesY, tx1 = -1, ty1 = -1;
+    for (int ty = 0; ty < cur->tilesY; ty++) {
+        for (int tx = 0; tx < cur->tilesX; tx++) {
+            int k = ty * cur->tilesX + tx;
+            if (prev->hash[k] == cur->hash[k]) continue;
+            if (tx < tx0) tx0 = tx;
+            if (tx > tx1) tx1 = tx;
+            if (ty < ty0) ty0 = ty;
+            if (ty > ty1) ty1 = ty;
+        }
+    }
+    if (tx1 < 0)
+        return (TileRect) { 0, 0, 0, 0 };
+    
+    int x0 = tx0 * cur->tileSize, y0 = ty0 * cur->tileSize;
+    int x1 = (tx1 + 1) * cur->tileSize, y1 = (ty1 + 1) * cur->tileSize;
+    if (x1 > cur->width) x1 = cur->width;
+    if (y1 > cur->height) y1 = cur->height;
+    return (TileRect) { x0, y0, x1 - x0, y1 - y0 };
+}
@@ -0,0 +1,64 @@
+#ifndef TILE_MAP_H
+#define TILE_MAP_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit FNV-1a constants, used (a word at a time) to hash each tile's
+// pixels as they are rendered.
+// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+#define TILE_HASH_OFFSET 0xcbf29ce484222325ull
+#define TILE_HASH_PRIME 0x100000001b3ull
+
+// Per-tile hashes of a frame, filled in by traceGlobeParallel(). Comparing
+// two frames' maps finds the tiles that changed without touching the
+// pixels. Equal hashes are taken to mean equal tiles.
+typedef struct TileMap {
+    int width, height;
+    // Tiles are tileSize x tileSize pixels, smaller at the right and bottom
+    // edges.
+    int tileSize;
+    int tilesX, tilesY;
+    // Hash of each tile, row by row.
+    uint64_t* hash;
+    // Hash of each tile's slice of each pixel row (height * tilesX),
+    // written by the renderer. Rows are rendered by different threads, so
+    // they are only combined into tile hashes once the frame is done.
+    uint64_t* rowHash;
+} TileMap;
+
+// Hash n bytes, 8 at a time. The renderer calls this on each tile's slice
+// of a row right after writing it, while the bytes are still in L1.
+static inline uint64_t tileHashBytes(const uint8_t* p, int n) {
+    uint64_t h = TILE_HASH_OFFSET;
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        uint64_t word;
+        memcpy(&word, p + k, 8);
+        h = (h ^ word) * TILE_HASH_PRIME;
+    }
+    for (; k < n; k++)
+        h = (h ^ p[k]) * TILE_HASH_PRIME;
+    return h;
+}
+
+// Pixel rectangle, empty when width or height is 0.
+typedef struct TileRect {
+    int x, y, width, height;
+} TileRect;
+
+TileMap* tileMapCreate(int width, int height, int tileSize);
+void tileMapFree(TileMap* tiles);
+
+// Combine rowHash into hash. Called by the renderer at the end of a frame.
+void tileMapFinish(TileMap* tiles);
+
+// Mark dirty[k] = 1 for every tile whose hash differs between the frames
+// (dirty has tilesX * tilesY entries, or may be NULL). Returns the number
+// of dirty tiles.
+int tileMapDiff(const TileMap* prev, const TileMap* cur, uint8_t* dirty);
+
+// Pixel bounding rectangle of all tiles that differ between the frames.
+TileRect tileMapDirtyRect(const TileMap* prev, const TileMap* cur);
+
+#endif
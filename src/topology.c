@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+
+// Lowest CPU in a sysfs CPU list such as "0-1" or "2,10", which identifies
+// the physical core that thread_siblings_list describes. -1 on failure.
+static int firstSibling(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path),
+        "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+    
+    char buf[256];
+    int first = -1;
+    if (fgets(buf, sizeof(buf), file)) {
+        // Entries are single CPUs or ranges, separated by commas. The
+        // lowest CPU is the lowest number anywhere in the list.
+        for (char* s = buf; *s; s++) {
+            if (*s < '0' || *s > '9')
+                continue;
+            long n = strtol(s, &s, 10);
+            if (first < 0 || n < first) first = (int) n;
+            if (!*s) break;
+        }
+    }
+    fclose(file);
+    return first;
+}
+
+void cpuTopologyRead(CpuTopology* topology) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        CPU_SET(0, &set);
+    
+    int numCpus = CPU_COUNT(&set);
+    topology->numCpus = 0;
+    topology->numCores = 0;
+    topology->cores = (CpuCore*) calloc(numCpus, sizeof(CpuCore));
+    // First sibling of each core in cores, to find a CPU's core by.
+    int* keys = (int*) malloc(numCpus * sizeof(int));
+    
+    for (int cpu = 0; cpu < CPU_SETSIZE && topology->numCpus < numCpus;
+        cpu++) {
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+        topology->numCpus++;
+        
+        int key = firstSibling(cpu);
+        if (key < 0) key = cpu;
+        int k = 0;
+        while (k < topology->numCores && keys[k] != key) k++;
+        if (k == topology->numCores) {
+            keys[k] = key;
+            topology->numCores++;
+        }
+        CpuCore* core = &topology->cores[k];
+        if (core->numThreads < CPU_CORE_MAX_THREADS)
+            core->threads[core->numThreads++] = cpu;
+    }
+    free(keys);
+}
+
+void cpuTopologyFree(CpuTopology* topology) {
+    free(topology->cores);
+    topology->cores = NULL;
+    topology->numCores = 0;
+}
+
+int cpuPinThread(pthread_t thread, int cpu) {
+    if (cpu < 0)
+        return 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+void placementPlan(const CpuTopology* topology, Placement placement,
+    int maxRender, ThreadPlacement* plan) {
+    
+    int numCpus = topology->numCpus > 0 ? topology->numCpus : 1;
+    plan->renderCpus = (int*) malloc(numCpus * sizeof(int));
+    plan->numRender = 0;
+    plan->encodeCpu = -1;
+    const CpuCore* cores = topology->cores;
+    int numCores = topology->numCores;
+    
+    if (placement == PLACEMENT_SMT_PAIR && numCores > 0) {
+        // The encoder takes the last sibling of the first core with more
+        // than one, or of the first core if SMT is off.
+        int pair = 0;
+        while (pair < numCores && cores[pair].numThreads < 2) pair++;
+        if (pair == numCores) pair = 0;
+        const CpuCore* core = &cores[pair];
+        plan->encodeCpu = core->threads[core->numThreads - 1];
+        for (int k = 0; k < numCores; k++) {
+            for (int t = 0; t < cores[k].numThreads; t++) {
+                if (cores[k].threads[t] != plan->encodeCpu || numCpus == 1)
+                    plan->renderCpus[plan->numRender++] = cores[k].threads[t];
+            }
+        }
+    } else if (placement == PLACEMENT_ONE_PER_CORE && numCores > 0) {
+        plan->encodeCpu = cores[0].threads[0];
+        for (int k = numCores > 1 ? 1 : 0; k < numCores; k++)
+            plan->renderCpus[plan->numRender++] = cores[k].threads[0];
+    } else {
+        for (int i = 0; i < numCpus; i++)
+            plan->renderCpus[plan->numRender++] = -1;
+    }
+    
+    if (maxRender > 0 && plan->numRender > maxRender)
+        plan->numRender = maxRender;
+}
+
+void placementFree(ThreadPlacement* plan) {
+    free(plan->renderCpus);
+    plan->renderCpus = NULL;
+}
+
+const char* placementName(Placement placement) {
+    switch (placement) {
+        case PLACEMENT_SMT_PAIR: return "smt-pair";
+        case PLACEMENT_ONE_PER_CORE: return "one-per-core";
+        default: return "naive";
+    }
+}
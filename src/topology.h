@@ -0,0 +1,59 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <pthread.h>
+
+#define CPU_CORE_MAX_THREADS 8
+
+// A physical core and the hardware threads (SMT siblings) we may run on.
+typedef struct CpuCore {
+    int numThreads;
+    int threads[CPU_CORE_MAX_THREADS];
+} CpuCore;
+
+// CPUs in our affinity mask grouped by physical core, from each CPU's
+// topology/thread_siblings_list in sysfs. Without sysfs every CPU counts as
+// a core of its own.
+typedef struct CpuTopology {
+    int numCpus;
+    int numCores;
+    CpuCore* cores;
+} CpuTopology;
+
+void cpuTopologyRead(CpuTopology* topology);
+void cpuTopologyFree(CpuTopology* topology);
+
+// Restrict a thread to one CPU. Does nothing for cpu < 0. Returns 0 on
+// failure.
+int cpuPinThread(pthread_t thread, int cpu);
+
+// Where the render workers and the (single, since GIF encoding is serial)
+// encode thread of a render/encode pipeline run.
+typedef enum Placement {
+    // As many render workers as CPUs, nothing pinned.
+    PLACEMENT_NAIVE,
+    // Render workers on every hardware thread but one. The encoder takes
+    // that one, so it shares a core with a render worker: the trace loop is
+    // bound by floating point and the encoder by memory and branches, so
+    // they compete little for the core.
+    PLACEMENT_SMT_PAIR,
+    // One thread per physical core: the encoder on the first core, render
+    // workers on the others, siblings left idle.
+    PLACEMENT_ONE_PER_CORE
+} Placement;
+
+typedef struct ThreadPlacement {
+    int numRender;
+    // CPU of each render worker, -1 for unpinned.
+    int* renderCpus;
+    int encodeCpu;
+} ThreadPlacement;
+
+// Plan thread placement. maxRender > 0 caps the number of render workers.
+void placementPlan(const CpuTopology* topology, Placement placement,
+    int maxRender, ThreadPlacement* plan);
+void placementFree(ThreadPlacement* plan);
+
+const char* placementName(Placement placement);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef VEC3_H
+#define VEC3_H
+
+#define PI 3.141592653589793
+#define PI_OVER_TWO 1.570796326794896
+#define TWO_PI 6.283185307179586
+#define DEG_TO_RAD 0.01745329251994329
+
+typedef struct Vec3 {
+    double x, y, z;
+} Vec3;
+
+// Sum of two vectors.
+static inline Vec3 vsum(Vec3 a, Vec3 b) {
+    return (Vec3) { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+// Difference of two vectors.
+static inline Vec3 vdiff(Vec3 a, Vec3 b) {
+    return (Vec3) { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+// Scale a vector.
+static inline Vec3 vscl(Vec3 a, double s) {
+    return (Vec3) { s * a.x, s * a.y, s * a.z };
+}
+
+// Component-wise product of two vectors.
+static inline Vec3 vmul(Vec3 a, Vec3 b) {
+    return (Vec3) { a.x * b.x, a.y * b.y, a.z * b.z };
+}
+
+// Cartesian dot product of two vectors.
+// https://en.wikipedia.org/wiki/Dot_product
+static inline double vdot(Vec3 a, Vec3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Get magnitude squared (length squared) of a vector.
+// The dot product of a vector with itself is equivalent to the
+// pythagorean theorem.
+// https://en.wikipedia.org/wiki/Dot_product
+static inline double vmag2(Vec3 a) {
+    return vdot(a, a);
+}
+
+// Rotate on XY plane.
+// https://en.wikipedia.org/wiki/Rotation_matrix
+static inline Vec3 vrotxy(Vec3 v, double c, double s) {
+    return (Vec3) { v.x * c - v.y * s, v.x * s + v.y * c, v.z };
+}
+
+// Rotate on YZ plane.
+// https://en.wikipedia.org/wiki/Rotation_matrix
+static inline Vec3 vrotyz(Vec3 v, double c, double s) {
+    return (Vec3) { v.x, v.y * c - v.z * s, v.y * s + v.z * c };
+}
+
+// Rotate on ZX plane.
+// https://en.wikipedia.org/wiki/Rotation_matrix
+static inline Vec3 vrotzx(Vec3 v, double c, double s) {
+    return (Vec3) { v.z * s + v.x * c, v.y, v.z * c - v.x * s };
+}
+
+#endif